@@ -59,5 +59,8 @@ option (WITH_DEFAULT_LOGGER "Build with default logger" ON)
 
 option (WITH_DOC "Build with documentation" ON)
 
+option (WITH_IO_DEBUG "Check bounds of direct I/O region accesses" OFF)
+set (METAL_IO_DEBUG ${WITH_IO_DEBUG})
+
 set (PROJECT_EC_FLAGS "-Wall -Werror -Wextra" CACHE STRING "")
 # vim: expandtab:ts=2:sw=2:smartindent
@@ -140,17 +140,9 @@ static int ipi_irq_handler (int vect_id, void *priv)
  */
 static int measure_shmem_latencyd(struct channel_s *ch)
 {
-	void *lbuf = NULL;
-	struct msg_hdr_s *msg_hdr;
+	struct msg_hdr_s msg_hdr;
 	int ret = 0;
 
-	/* allocate memory for receiving data */
-	lbuf = metal_allocate_memory(BUF_SIZE_MAX);
-	if (!lbuf) {
-		LPERROR("Failed to allocate memory.\r\n");
-		return -1;
-	}
-
 	LPRINTF("Starting IPI latency demo\r\n");
 	while(1) {
 		wait_for_notified(&ch->remote_nkicked);
@@ -158,30 +150,25 @@ static int measure_shmem_latencyd(struct channel_s *ch)
 			DEMO_STATUS_START) {
 			/* Read message header from shared memory */
 			metal_io_block_read(ch->shm_io, SHM_BUFF_OFFSET_RX,
-				lbuf, sizeof(struct msg_hdr_s));
-			msg_hdr = (struct msg_hdr_s *)lbuf;
+				&msg_hdr, sizeof(msg_hdr));
 
 			/* Check if the message header is valid */
-			if (msg_hdr->len > (BUF_SIZE_MAX - sizeof(*msg_hdr))) {
+			if (msg_hdr.len > (BUF_SIZE_MAX - sizeof(msg_hdr))) {
 				LPERROR("wrong msg: length invalid: %u, %u.\n",
-					BUF_SIZE_MAX - sizeof(*msg_hdr),
-					msg_hdr->len);
+					BUF_SIZE_MAX - sizeof(msg_hdr),
+					msg_hdr.len);
 				ret = -EINVAL;
 				goto out;
 			}
-			/* Read message */
-			metal_io_block_read(ch->shm_io,
-					SHM_BUFF_OFFSET_RX + sizeof(*msg_hdr),
-					lbuf + sizeof(*msg_hdr), msg_hdr->len);
 			/* Stop APU to RPU TTC counter */
 			stop_timer(ch->ttc_io, TTC_CNT_APU_TO_RPU);
 
 			/* Reset RPU to APU TTC counter */
 			reset_timer(ch->ttc_io, TTC_CNT_RPU_TO_APU);
 			/* Copy the message back to the other end */
-			metal_io_block_write(ch->shm_io, SHM_BUFF_OFFSET_TX,
-					msg_hdr,
-					sizeof(*msg_hdr) + msg_hdr->len);
+			metal_io_block_copy(ch->shm_io, SHM_BUFF_OFFSET_TX,
+					ch->shm_io, SHM_BUFF_OFFSET_RX,
+					sizeof(msg_hdr) + msg_hdr.len);
 
 			/* Kick IPI to notify the remote */
 			metal_io_write32(ch->ipi_io, IPI_TRIG_OFFSET,
@@ -192,7 +179,6 @@ static int measure_shmem_latencyd(struct channel_s *ch)
 	}
 
 out:
-	metal_free_memory(lbuf);
 	return ret;
 }
 
@@ -34,7 +34,6 @@
 #include <sys/types.h>
 #include <metal/sys.h>
 #include <metal/io.h>
-#include <metal/alloc.h>
 #include <metal/device.h>
 #include <metal/irq.h>
 #include <errno.h>
@@ -108,16 +107,11 @@ static int ipi_shmem_echod(struct metal_io_region *ipi_io,
 	unsigned long rx_used_offset;
 	unsigned long tx_addr_offset, rx_addr_offset;
 	unsigned long tx_data_offset, rx_data_offset;
-	void *lbuf = NULL;
-	struct msg_hdr_s *msg_hdr;
+	unsigned long msg_offset;
+	struct msg_hdr_s msg_hdr;
+	char cmd[sizeof(SHUTDOWN)];
 	uint32_t ipi_mask = IPI_MASK;
 
-	lbuf = metal_allocate_memory(BUF_SIZE_MAX);
-	if (!lbuf) {
-		LPERROR("Failed to allocate local buffer for msg.\n");
-		ret = -ENOMEM;
-		goto out;
-	}
 	/* Clear shared memory */
 	metal_io_block_set(shm_io, 0, 0, metal_io_region_size(shm_io));
 
@@ -157,40 +151,38 @@ static int ipi_shmem_echod(struct metal_io_region *ipi_io,
 			rx_addr_offset += sizeof(buf_phy_addr_32);
 
 			/* Read message header from shared memory */
-			metal_io_block_read(shm_io, rx_data_offset, lbuf,
-				sizeof(struct msg_hdr_s));
-			msg_hdr = (struct msg_hdr_s *)lbuf;
+			msg_offset = rx_data_offset;
+			metal_io_block_read(shm_io, msg_offset, &msg_hdr,
+				sizeof(msg_hdr));
 
 			/* Check if the message header is valid */
-			if (msg_hdr->len > (BUF_SIZE_MAX - sizeof(*msg_hdr))) {
+			if (msg_hdr.len > (BUF_SIZE_MAX - sizeof(msg_hdr))) {
 				LPERROR("wrong msg: length invalid: %u, %u.\n",
-					BUF_SIZE_MAX - sizeof(*msg_hdr),
-					msg_hdr->len);
+					BUF_SIZE_MAX - sizeof(msg_hdr),
+					msg_hdr.len);
 				ret = -EINVAL;
 				goto out;
 			}
-			rx_data_offset += sizeof(*msg_hdr);
-			/* Read message */
-			metal_io_block_read(shm_io,
-					rx_data_offset,
-					lbuf + sizeof(*msg_hdr), msg_hdr->len);
-			rx_data_offset += msg_hdr->len;
+			rx_data_offset += sizeof(msg_hdr) + msg_hdr.len;
 			rx_count++;
 			/* increase rx used count to indicate it has consumed
 			 * the received data */
 			metal_io_write32(shm_io, rx_used_offset, rx_count);
 
 			/* Check if the it is the shutdown message */
-			if (msg_hdr->len == strlen(SHUTDOWN) &&
-				!strncmp(SHUTDOWN,
-					(lbuf + sizeof(struct msg_hdr_s)),
-					strlen(SHUTDOWN))) {
+			if (msg_hdr.len == strlen(SHUTDOWN)) {
+				metal_io_block_read(shm_io,
+					msg_offset + sizeof(msg_hdr),
+					cmd, strlen(SHUTDOWN));
+				if (!strncmp(SHUTDOWN, cmd, strlen(SHUTDOWN))) {
 					LPRINTF("Received shutdown message\n");
 					goto out;
+				}
 			}
 			/* Copy the message back to the other end */
-			metal_io_block_write(shm_io, tx_data_offset, msg_hdr,
-				sizeof(struct msg_hdr_s) + msg_hdr->len);
+			metal_io_block_copy(shm_io, tx_data_offset,
+				shm_io, msg_offset,
+				sizeof(msg_hdr) + msg_hdr.len);
 
 			/* Write to the address array to tell the other end
 			 * the buffer address.
@@ -199,8 +191,7 @@ static int ipi_shmem_echod(struct metal_io_region *ipi_io,
 						tx_data_offset);
 			metal_io_write32(shm_io, tx_addr_offset,
 					buf_phy_addr_32);
-			tx_data_offset += sizeof(struct msg_hdr_s) +
-				msg_hdr->len;
+			tx_data_offset += sizeof(msg_hdr) + msg_hdr.len;
 			tx_addr_offset += sizeof(uint32_t);
 
 			/* Increase number of available buffers */
@@ -216,8 +207,6 @@ out:
 	LPRINTF("IPI with shared memory demo finished with exit code: %i.\n",
 		ret);
 
-	if (lbuf)
-		metal_free_memory(lbuf);
 	return ret;
 }
 
@@ -85,12 +85,14 @@ typedef enum {
 		*exp = oldval;						\
 		oldval == expval;					\
 	})
-#define atomic_compare_exchange_strong_explicit(OBJ, EXP, DES, MO)	\
-	atomic_compare_exchange_strong((OBJ), (EXP), (DES))
+#define atomic_compare_exchange_strong_explicit(OBJ, EXP, DES, SMO, FMO) \
+	((void)(SMO), (void)(FMO),					\
+	 atomic_compare_exchange_strong((OBJ), (EXP), (DES)))
 #define atomic_compare_exchange_weak(OBJ, EXP, DES)			\
 	atomic_compare_exchange_strong((OBJ), (EXP), (DES))
-#define atomic_compare_exchange_weak_explicit(OBJ, EXP, DES, MO)	\
-	atomic_compare_exchange_weak((OBJ), (EXP), (DES))
+#define atomic_compare_exchange_weak_explicit(OBJ, EXP, DES, SMO, FMO)	\
+	((void)(SMO), (void)(FMO),					\
+	 atomic_compare_exchange_weak((OBJ), (EXP), (DES)))
 #define atomic_fetch_add(OBJ, VAL)					\
 	__sync_fetch_and_add((OBJ), (VAL))
 #define atomic_fetch_add_explicit(OBJ, VAL, MO)				\
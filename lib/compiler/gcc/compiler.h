@@ -20,6 +20,14 @@ extern "C" {
 #define metal_align(n) __attribute__((aligned(n)))
 #define metal_weak __attribute__((weak))
 
+#define metal_bswap16(x) __builtin_bswap16(x)
+#define metal_bswap32(x) __builtin_bswap32(x)
+#define metal_bswap64(x) __builtin_bswap64(x)
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define METAL_BIG_ENDIAN 1
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -20,6 +20,19 @@ extern "C" {
 #define metal_align(n) __attribute__((aligned(n)))
 #define metal_weak __attribute__((weak))
 
+#define metal_bswap16(x)						\
+	((unsigned short)((((x) >> 8) & 0xff) | (((x) & 0xff) << 8)))
+#define metal_bswap32(x)						\
+	((((x) & 0xff000000UL) >> 24) | (((x) & 0x00ff0000UL) >> 8) |	\
+	 (((x) & 0x0000ff00UL) << 8) | (((x) & 0x000000ffUL) << 24))
+#define metal_bswap64(x)						\
+	(((unsigned long long)metal_bswap32((unsigned long)(x)) << 32) |	\
+	 metal_bswap32((unsigned long)((x) >> 32)))
+
+#if defined(__LITTLE_ENDIAN__) && __LITTLE_ENDIAN__ == 0
+#define METAL_BIG_ENDIAN 1
+#endif
+
 #ifdef __cplusplus
 }
 #endif
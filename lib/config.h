@@ -43,6 +43,9 @@ extern "C" {
 #cmakedefine HAVE_STDATOMIC_H
 #cmakedefine HAVE_FUTEX_H
 
+/** Check bounds of direct I/O region accesses. */
+#cmakedefine METAL_IO_DEBUG
+
 #ifdef __cplusplus
 }
 #endif
@@ -84,6 +84,41 @@ void metal_device_close(struct metal_device *device)
 		device->bus->ops.dev_close(device->bus, device);
 }
 
+struct metal_device *metal_device_ref_get(struct metal_bus *bus,
+					  const char *dev_name)
+{
+	struct metal_device_ref *ref;
+	struct metal_list *node;
+
+	metal_list_for_each(&bus->devices, node) {
+		ref = metal_container_of(node, struct metal_device_ref,
+					 device.node);
+		if (!strcmp(ref->device.name, dev_name)) {
+			ref->refs++;
+			return &ref->device;
+		}
+	}
+	return NULL;
+}
+
+void metal_device_ref_add(struct metal_bus *bus,
+			  struct metal_device_ref *ref)
+{
+	ref->refs = 1;
+	ref->device.bus = bus;
+	metal_list_add_tail(&bus->devices, &ref->device.node);
+}
+
+unsigned metal_device_ref_put(struct metal_device *device)
+{
+	struct metal_device_ref *ref;
+
+	ref = metal_container_of(device, struct metal_device_ref, device);
+	if (!--ref->refs)
+		metal_list_del(&device->node);
+	return ref->refs;
+}
+
 int metal_register_generic_device(struct metal_device *device)
 {
 	if (!device->name || !strlen(device->name) ||
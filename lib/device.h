@@ -31,6 +31,7 @@ extern "C" {
 
 struct metal_bus;
 struct metal_device;
+struct metal_io_async;
 
 /** Bus operations. */
 struct metal_bus_ops {
@@ -54,6 +55,9 @@ struct metal_bus_ops {
 				       uint32_t dir,
 				       struct metal_sg *sg,
 				       int nents);
+	int		(*dev_async_init)(struct metal_bus *bus,
+					  struct metal_device *device,
+					  struct metal_io_async *async);
 };
 
 /** Libmetal bus structure. */
@@ -67,17 +71,26 @@ struct metal_bus {
 /** Libmetal generic bus. */
 extern struct metal_bus metal_generic_bus;
 
-/** Libmetal device structure. */
+/**
+ * Libmetal device structure.
+ *
+ * Buses may allocate a device truncated after its last used region, so
+ * regions must stay the last member, and devices of a bus must not be
+ * copied or sized with sizeof.
+ */
 struct metal_device {
 	const char             *name;       /**< Device name */
 	struct metal_bus       *bus;        /**< Bus that contains device */
 	unsigned               num_regions; /**< Number of I/O regions in
 					      device */
-	struct metal_io_region regions[METAL_MAX_DEVICE_REGIONS]; /**< Array of
-                                                        I/O regions in device*/
 	struct metal_list      node;       /**< Node on bus' list of devices */
 	int                    irq_num;    /**< Number of IRQs per device */
 	void                   *irq_info;  /**< IRQ ID */
+	struct metal_io_region regions[METAL_MAX_DEVICE_REGIONS]; /**< Array of
+                                                        I/O regions in device,
+                                                        kept last so that buses
+                                                        may allocate only
+                                                        num_regions */
 };
 
 /**
@@ -121,6 +134,11 @@ extern int metal_register_generic_device(struct metal_device *device);
 
 /**
  * @brief	Open a libmetal device by name.
+ *
+ * Opening a device that is already open returns the same shared handle,
+ * with its mappings and interrupt, and takes a reference to it.  Each
+ * open must be balanced by a metal_device_close().
+ *
  * @param[in]	bus_name	Bus name.
  * @param[in]	dev_name	Device name.
  * @param[out]	device		Returned device handle.
@@ -130,7 +148,7 @@ extern int metal_device_open(const char *bus_name, const char *dev_name,
 			     struct metal_device **device);
 
 /**
- * @brief	Close a libmetal device.
+ * @brief	Close a libmetal device, dropping a reference to it.
  * @param[in]	device		Device handle.
  */
 extern void metal_device_close(struct metal_device *device);
@@ -167,6 +185,44 @@ extern void metal_generic_dev_dma_unmap(struct metal_bus *bus,
 					uint32_t dir,
 					struct metal_sg *sg,
 					int nents);
+
+/** Device handle shared by all openers, for buses that allocate devices. */
+struct metal_device_ref {
+	unsigned		refs;       /**< number of opens */
+	struct metal_device	device;     /**< shared device, last */
+};
+
+/**
+ * @brief	Find an open device on a bus and take a reference to it.
+ *
+ * The caller serializes this with the other metal_device_ref calls for
+ * the bus.
+ *
+ * @param[in]	bus		Bus the device is open on.
+ * @param[in]	dev_name	Device name.
+ * @return	Device, or NULL if it is not open.
+ */
+extern struct metal_device *metal_device_ref_get(struct metal_bus *bus,
+						 const char *dev_name);
+
+/**
+ * @brief	Add a newly opened device to a bus, with one reference.
+ * @param[in]	bus		Bus the device was opened on.
+ * @param[in]	ref		Device, with its name set.
+ */
+extern void metal_device_ref_add(struct metal_bus *bus,
+				 struct metal_device_ref *ref);
+
+/**
+ * @brief	Drop a reference to an open device.
+ *
+ * The device is taken off its bus when the last reference is dropped,
+ * and the caller then closes and frees it.
+ *
+ * @param[in]	device		Device.
+ * @return	Number of references left.
+ */
+extern unsigned metal_device_ref_put(struct metal_device *device);
 #endif /* METAL_INTERNAL */
 
 #ifdef __cplusplus
@@ -5,6 +5,7 @@
  */
 
 #include <string.h>
+#include <metal/io.h>
 #include <metal/sys.h>
 
 int metal_init(const struct metal_init_params *params)
@@ -20,6 +21,8 @@ int metal_init(const struct metal_init_params *params)
 	metal_list_init(&_metal.common.generic_shmem_list);
 	metal_list_init(&_metal.common.generic_device_list);
 
+	metal_io_copy_init();
+
 	error = metal_sys_init(params);
 	if (error)
 		return error;
@@ -6,16 +6,410 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <metal/dma.h>
 #include <metal/io.h>
+#include <metal/sleep.h>
 #include <metal/sys.h>
+#include <metal/time.h>
+#include <metal/utilities.h>
 
-void metal_io_init(struct metal_io_region *io, void *virt,
-	      const metal_phys_addr_t *physmap, size_t size,
-	      unsigned page_shift, unsigned int mem_flags,
-	      const struct metal_io_ops *ops)
+static void metal_io_copy_generic(void *restrict dst,
+				  const void *restrict src, size_t len)
+{
+	unsigned char *dest = dst;
+	const unsigned char *source = src;
+
+	while ( len && (
+		((uintptr_t)dest % sizeof(int)) ||
+		((uintptr_t)source % sizeof(int)))) {
+		*dest = *source;
+		dest++;
+		source++;
+		len--;
+	}
+	for (; len >= sizeof(int); dest += sizeof(int),
+				source += sizeof(int),
+				len -= sizeof(int))
+		*(unsigned int *)dest = *(const unsigned int *)source;
+	for (; len != 0; dest++, source++, len--)
+		*dest = *source;
+}
+
+static void metal_io_set_generic(void *dst, unsigned char value, size_t len)
+{
+	unsigned char *ptr = dst;
+	unsigned int cint = value;
+	unsigned int i;
+
+	for (i = 1; i < sizeof(int); i++)
+		cint |= ((unsigned int)value << (8 * i));
+
+	for (; len && ((uintptr_t)ptr % sizeof(int)); ptr++, len--)
+		*ptr = value;
+	for (; len >= sizeof(int); ptr += sizeof(int), len -= sizeof(int))
+		*(unsigned int *)ptr = cint;
+	for (; len != 0; ptr++, len--)
+		*ptr = value;
+}
+
+/* CRC32C (Castagnoli), reflected polynomial 0x82f63b78. */
+static const uint32_t metal_io_crc32c_table[256] = {
+	0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4,
+	0xc79a971f, 0x35f1141c, 0x26a1e7e8, 0xd4ca64eb,
+	0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+	0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24,
+	0x105ec76f, 0xe235446c, 0xf165b798, 0x030e349b,
+	0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+	0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54,
+	0x5d1d08bf, 0xaf768bbc, 0xbc267848, 0x4e4dfb4b,
+	0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+	0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35,
+	0xaa64d611, 0x580f5512, 0x4b5fa6e6, 0xb93425e5,
+	0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+	0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45,
+	0xf779deae, 0x05125dad, 0x1642ae59, 0xe4292d5a,
+	0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+	0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595,
+	0x417b1dbc, 0xb3109ebf, 0xa0406d4b, 0x522bee48,
+	0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+	0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687,
+	0x0c38d26c, 0xfe53516f, 0xed03a29b, 0x1f682198,
+	0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+	0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38,
+	0xdbfc821c, 0x2997011f, 0x3ac7f2eb, 0xc8ac71e8,
+	0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+	0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096,
+	0xa65c047d, 0x5437877e, 0x4767748a, 0xb50cf789,
+	0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+	0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46,
+	0x7198540d, 0x83f3d70e, 0x90a324fa, 0x62c8a7f9,
+	0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+	0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36,
+	0x3cdb9bdd, 0xceb018de, 0xdde0eb2a, 0x2f8b6829,
+	0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+	0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93,
+	0x082f63b7, 0xfa44e0b4, 0xe9141340, 0x1b7f9043,
+	0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+	0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3,
+	0x55326b08, 0xa759e80b, 0xb4091bff, 0x466298fc,
+	0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+	0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033,
+	0xa24bb5a6, 0x502036a5, 0x4370c551, 0xb11b4652,
+	0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+	0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d,
+	0xef087a76, 0x1d63f975, 0x0e330a81, 0xfc588982,
+	0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+	0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622,
+	0x38cc2a06, 0xcaa7a905, 0xd9f75af1, 0x2b9cd9f2,
+	0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+	0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530,
+	0x0417b1db, 0xf67c32d8, 0xe52cc12c, 0x1747422f,
+	0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+	0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0,
+	0xd3d3e1ab, 0x21b862a8, 0x32e8915c, 0xc083125f,
+	0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+	0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90,
+	0x9e902e7b, 0x6cfbad78, 0x7fab5e8c, 0x8dc0dd8f,
+	0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+	0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1,
+	0x69e9f0d5, 0x9b8273d6, 0x88d28022, 0x7ab90321,
+	0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+	0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81,
+	0x34f4f86a, 0xc69f7b69, 0xd5cf889d, 0x27a40b9e,
+	0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+	0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351,
+};
+
+static uint32_t metal_io_copy_crc32c_generic(void *restrict dst,
+					     const void *restrict src,
+					     size_t len, uint32_t crc)
+{
+	unsigned char *dest = dst;
+	const unsigned char *source = src;
+	unsigned char c;
+
+	for (; len != 0; dest++, source++, len--) {
+		c = *source;
+		*dest = c;
+		crc = metal_io_crc32c_table[(crc ^ c) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+static uint32_t metal_io_crc32c_generic(const void *buf, size_t len,
+					uint32_t crc)
+{
+	const unsigned char *p = buf;
+
+	for (; len != 0; p++, len--)
+		crc = metal_io_crc32c_table[(crc ^ *p) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static void metal_io_copy_swap_generic(void *restrict dst,
+				       const void *restrict src,
+				       size_t len, int width)
+{
+	unsigned char *dest = dst;
+	const unsigned char *source = src;
+	uint64_t v64;
+	uint32_t v32;
+	uint16_t v16;
+
+	for (; len != 0; dest += width, source += width, len -= width) {
+		switch (width) {
+		case 8:
+			memcpy(&v64, source, 8);
+			v64 = metal_bswap64(v64);
+			memcpy(dest, &v64, 8);
+			break;
+		case 4:
+			memcpy(&v32, source, 4);
+			v32 = metal_bswap32(v32);
+			memcpy(dest, &v32, 4);
+			break;
+		default:
+			memcpy(&v16, source, 2);
+			v16 = metal_bswap16(v16);
+			memcpy(dest, &v16, 2);
+			break;
+		}
+	}
+}
+
+static const struct metal_io_copy_ops metal_io_copy_generic_ops = {
+	.name		= "generic",
+	.copy		= metal_io_copy_generic,
+	.set		= metal_io_set_generic,
+	.stream_write	= metal_io_copy_generic,
+	.stream_read	= metal_io_copy_generic,
+	.copy_crc32c	= metal_io_copy_crc32c_generic,
+	.copy_swap	= metal_io_copy_swap_generic,
+};
+
+static const struct metal_io_copy_ops *metal_io_copy =
+	&metal_io_copy_generic_ops;
+
+void metal_io_copy_init(void)
+{
+	const struct metal_io_copy_ops *ops = metal_processor_io_copy_ops();
+
+	metal_io_copy = ops ? ops : &metal_io_copy_generic_ops;
+	metal_log(METAL_LOG_DEBUG, "using %s block copy engine%s\n",
+		  metal_io_copy->name,
+		  metal_io_copy->copy_crc32c ? " with crc32c" : "");
+}
+
+/* Subregion ops pass accesses to the parent at the view offset. */
+static uint64_t metal_io_sub_read(struct metal_io_region *io,
+				  unsigned long offset,
+				  memory_order order,
+				  int width)
+{
+	return io->parent->ops.read(io->parent, io->base + offset, order,
+				    width);
+}
+
+static void metal_io_sub_write(struct metal_io_region *io,
+			       unsigned long offset,
+			       uint64_t value,
+			       memory_order order,
+			       int width)
+{
+	io->parent->ops.write(io->parent, io->base + offset, value, order,
+			      width);
+}
+
+static int metal_io_sub_block_read(struct metal_io_region *io,
+				   unsigned long offset,
+				   void *restrict dst,
+				   memory_order order,
+				   int len)
+{
+	return io->parent->ops.block_read(io->parent, io->base + offset, dst,
+					  order, len);
+}
+
+static int metal_io_sub_block_write(struct metal_io_region *io,
+				    unsigned long offset,
+				    const void *restrict src,
+				    memory_order order,
+				    int len)
+{
+	return io->parent->ops.block_write(io->parent, io->base + offset,
+					   src, order, len);
+}
+
+static void metal_io_sub_block_set(struct metal_io_region *io,
+				   unsigned long offset,
+				   unsigned char value,
+				   memory_order order,
+				   int len)
+{
+	io->parent->ops.block_set(io->parent, io->base + offset, value,
+				  order, len);
+}
+
+static int metal_io_sub_block_readv(struct metal_io_region *io,
+				    unsigned long offset,
+				    struct metal_sg *sg,
+				    memory_order order,
+				    int nents)
+{
+	return io->parent->ops.block_readv(io->parent, io->base + offset,
+					   sg, order, nents);
+}
+
+static int metal_io_sub_block_writev(struct metal_io_region *io,
+				     unsigned long offset,
+				     const struct metal_sg *sg,
+				     memory_order order,
+				     int nents)
+{
+	return io->parent->ops.block_writev(io->parent, io->base + offset,
+					    sg, order, nents);
+}
+
+static uint64_t metal_io_sub_fetch_op(struct metal_io_region *io,
+				      unsigned long offset,
+				      enum metal_io_rmw_op op,
+				      uint64_t value,
+				      memory_order order,
+				      int width)
+{
+	return io->parent->ops.fetch_op(io->parent, io->base + offset, op,
+					value, order, width);
+}
+
+static int metal_io_sub_cmpxchg(struct metal_io_region *io,
+				unsigned long offset,
+				uint64_t *expected,
+				uint64_t desired,
+				memory_order order,
+				int width)
+{
+	return io->parent->ops.cmpxchg(io->parent, io->base + offset,
+				       expected, desired, order, width);
+}
+
+int metal_io_subregion(struct metal_io_region *parent, unsigned long offset,
+		       size_t size, struct metal_io_region *child)
+{
+	struct metal_io_region *root = parent->parent ? parent->parent : parent;
+	const struct metal_io_ops *ops = &root->ops;
+
+	if (offset > parent->size || size > parent->size - offset)
+		return -ERANGE;
+
+	/* Views of views refer straight to the region owning the ops. */
+	*child = *parent;
+	if (parent->virt != METAL_BAD_VA)
+		child->virt = (uint8_t *)parent->virt + offset;
+	child->size = size;
+	child->parent = root;
+	child->base = parent->base + offset;
+
+	memset(&child->ops, 0, sizeof(child->ops));
+	child->ops.read = ops->read ? metal_io_sub_read : NULL;
+	child->ops.write = ops->write ? metal_io_sub_write : NULL;
+	child->ops.block_read = ops->block_read ?
+				metal_io_sub_block_read : NULL;
+	child->ops.block_write = ops->block_write ?
+				 metal_io_sub_block_write : NULL;
+	child->ops.block_set = ops->block_set ? metal_io_sub_block_set : NULL;
+	child->ops.block_readv = ops->block_readv ?
+				 metal_io_sub_block_readv : NULL;
+	child->ops.block_writev = ops->block_writev ?
+				  metal_io_sub_block_writev : NULL;
+	child->ops.fetch_op = ops->fetch_op ? metal_io_sub_fetch_op : NULL;
+	child->ops.cmpxchg = ops->cmpxchg ? metal_io_sub_cmpxchg : NULL;
+	return 0;
+}
+
+static int metal_io_extent_phys_cmp(const void *a, const void *b)
 {
-	const struct metal_io_ops nops = {NULL, NULL, NULL, NULL, NULL, NULL};
+	const struct metal_io_extent *ea = a, *eb = b;
+
+	return ea->phys < eb->phys ? -1 : ea->phys > eb->phys;
+}
+
+static int metal_io_extent_offset_cmp(const void *a, const void *b)
+{
+	const struct metal_io_extent *ea = a, *eb = b;
+
+	return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+}
+
+/*
+ * Index num offset sorted extents at the start of ext, which has room for
+ * twice as many, by appending a phys sorted copy for reverse lookups.
+ */
+static void metal_io_index_extents(struct metal_io_region *io,
+				   struct metal_io_extent *ext,
+				   unsigned int num)
+{
+	memcpy(ext + num, ext, num * sizeof(*ext));
+	qsort(ext + num, num, sizeof(*ext), metal_io_extent_phys_cmp);
+	io->extents = ext;
+	io->num_extents = num;
+}
+
+static struct metal_io_extent *metal_io_alloc_extents(unsigned int num)
+{
+	if (num > UINT_MAX / (2 * sizeof(struct metal_io_extent)))
+		return NULL;
+	return metal_allocate_memory(2 * num * sizeof(struct metal_io_extent));
+}
+
+/*
+ * Compact a per-page physmap into physically contiguous extents.  When
+ * ext is NULL only the number of extents is returned.
+ */
+static unsigned int metal_io_compact_physmap(struct metal_io_region *io,
+					     struct metal_io_extent *ext)
+{
+	const metal_phys_addr_t *physmap = io->physmap;
+	size_t page_size = (size_t)io->page_mask + 1;
+	unsigned long offset;
+	unsigned int num = 0;
+	size_t len;
+
+	if (io->page_mask == (metal_phys_addr_t)(-1) || page_size >= io->size) {
+		if (physmap[0] == METAL_BAD_PHYS)
+			return 0;
+		if (ext) {
+			ext->offset = 0;
+			ext->size = io->size;
+			ext->phys = physmap[0];
+		}
+		return 1;
+	}
+
+	for (offset = 0; offset < io->size; offset += page_size, physmap++) {
+		len = metal_min(page_size, io->size - offset);
+		if (*physmap == METAL_BAD_PHYS)
+			continue;
+		if (offset && physmap[-1] != METAL_BAD_PHYS &&
+		    physmap[-1] + page_size == *physmap) {
+			if (ext)
+				ext[num - 1].size += len;
+			continue;
+		}
+		if (ext) {
+			ext[num].offset = offset;
+			ext[num].size = len;
+			ext[num].phys = *physmap;
+		}
+		num++;
+	}
+	return num;
+}
 
+static void metal_io_setup(struct metal_io_region *io, void *virt,
+			   const metal_phys_addr_t *physmap, size_t size,
+			   unsigned page_shift, unsigned int mem_flags,
+			   const struct metal_io_ops *ops)
+{
 	io->virt = virt;
 	io->physmap = physmap;
 	io->size = size;
@@ -26,15 +420,263 @@ void metal_io_init(struct metal_io_region *io, void *virt,
 	else
 		io->page_mask = (1UL << page_shift) - 1UL;
 	io->mem_flags = mem_flags;
-	io->ops = ops ? *ops : nops;
+	io->access_widths = METAL_IO_ACCESS_ANY;
+	io->endian = METAL_IO_ENDIAN_NATIVE;
+	io->parallel = 0;
+	io->stream = 0;
+	if (ops)
+		io->ops = *ops;
+	else
+		memset(&io->ops, 0, sizeof(io->ops));
+	io->direct = virt != METAL_BAD_VA && !io->ops.read && !io->ops.write;
+	io->num_extents = 0;
+	io->extents = NULL;
+	io->parent = NULL;
+	io->base = 0;
+}
+
+void metal_io_init(struct metal_io_region *io, void *virt,
+	      const metal_phys_addr_t *physmap, size_t size,
+	      unsigned page_shift, unsigned int mem_flags,
+	      const struct metal_io_ops *ops)
+{
+	struct metal_io_extent *ext;
+	unsigned int num;
+
+	metal_io_setup(io, virt, physmap, size, page_shift, mem_flags, ops);
+	if (physmap && size) {
+		num = metal_io_compact_physmap(io, NULL);
+		if (num == 1) {
+			metal_io_compact_physmap(io, &io->extent);
+			io->num_extents = 1;
+		} else if (num > 1) {
+			/* Keep the page walk if there is no memory to spare. */
+			ext = metal_io_alloc_extents(num);
+			if (ext) {
+				metal_io_compact_physmap(io, ext);
+				metal_io_index_extents(io, ext, num);
+			}
+		}
+	}
+
 	metal_sys_io_mem_map(io);
 }
 
-int metal_io_block_read(struct metal_io_region *io, unsigned long offset,
-	       void *restrict dst, int len)
+int metal_io_init_extents(struct metal_io_region *io, void *virt,
+			  const struct metal_io_extent *extents,
+			  unsigned int num_extents, size_t size,
+			  unsigned int mem_flags,
+			  const struct metal_io_ops *ops)
+{
+	struct metal_io_extent *ext;
+
+	metal_io_setup(io, virt, NULL, size, -1, mem_flags, ops);
+	if (num_extents == 1) {
+		io->extent = extents[0];
+		io->num_extents = 1;
+	} else if (num_extents > 1) {
+		ext = metal_io_alloc_extents(num_extents);
+		if (!ext)
+			return -ENOMEM;
+		memcpy(ext, extents, num_extents * sizeof(*ext));
+		qsort(ext, num_extents, sizeof(*ext),
+		      metal_io_extent_offset_cmp);
+		metal_io_index_extents(io, ext, num_extents);
+	}
+
+	metal_sys_io_mem_map(io);
+	return 0;
+}
+
+int metal_io_set_access_widths(struct metal_io_region *io,
+			       unsigned int widths)
+{
+	if (widths & ~(METAL_IO_ACCESS_8 | METAL_IO_ACCESS_16 |
+		       METAL_IO_ACCESS_32 | METAL_IO_ACCESS_64))
+		return -EINVAL;
+	io->access_widths = widths;
+	return 0;
+}
+
+static inline void metal_io_load(const void *ptr, void *word, int width)
+{
+	uint64_t v64;
+	uint32_t v32;
+	uint16_t v16;
+
+	switch (width) {
+	case 8:
+		v64 = *(const volatile uint64_t *)ptr;
+		memcpy(word, &v64, 8);
+		break;
+	case 4:
+		v32 = *(const volatile uint32_t *)ptr;
+		memcpy(word, &v32, 4);
+		break;
+	case 2:
+		v16 = *(const volatile uint16_t *)ptr;
+		memcpy(word, &v16, 2);
+		break;
+	default:
+		*(uint8_t *)word = *(const volatile uint8_t *)ptr;
+		break;
+	}
+}
+
+static inline void metal_io_store(void *ptr, const void *word, int width)
+{
+	uint64_t v64;
+	uint32_t v32;
+	uint16_t v16;
+
+	switch (width) {
+	case 8:
+		memcpy(&v64, word, 8);
+		*(volatile uint64_t *)ptr = v64;
+		break;
+	case 4:
+		memcpy(&v32, word, 4);
+		*(volatile uint32_t *)ptr = v32;
+		break;
+	case 2:
+		memcpy(&v16, word, 2);
+		*(volatile uint16_t *)ptr = v16;
+		break;
+	default:
+		*(volatile uint8_t *)ptr = *(const uint8_t *)word;
+		break;
+	}
+}
+
+/*
+ * Pick the access for the next chunk of a width constrained transfer: the
+ * widest allowed aligned access that fits, or else the narrowest allowed
+ * access containing addr.
+ */
+static inline int metal_io_access_width(unsigned int widths, uintptr_t addr,
+					size_t len)
+{
+	int width;
+
+	for (width = 8; width; width >>= 1) {
+		if ((widths & width) && !(addr & (width - 1)) &&
+		    len >= (size_t)width)
+			return width;
+	}
+	return widths & -widths;
+}
+
+static void metal_io_read_widths(unsigned int widths, void *dst,
+				 const uint8_t *ptr, size_t len)
+{
+	uint8_t word[8], *d = dst;
+	size_t head, n;
+	int width;
+
+	for (; len; ptr += n, d += n, len -= n) {
+		width = metal_io_access_width(widths, (uintptr_t)ptr, len);
+		head = (uintptr_t)ptr & (width - 1);
+		n = metal_min(width - head, len);
+		metal_io_load(ptr - head, word, width);
+		memcpy(d, word + head, n);
+	}
+}
+
+static void metal_io_write_widths(unsigned int widths, uint8_t *ptr,
+				  const void *src, size_t len)
+{
+	const uint8_t *s = src;
+	uint8_t word[8];
+	size_t head, n;
+	int width;
+
+	for (; len; ptr += n, s += n, len -= n) {
+		width = metal_io_access_width(widths, (uintptr_t)ptr, len);
+		head = (uintptr_t)ptr & (width - 1);
+		n = metal_min(width - head, len);
+		if (n < (size_t)width)
+			metal_io_load(ptr - head, word, width);
+		memcpy(word + head, s, n);
+		metal_io_store(ptr - head, word, width);
+	}
+}
+
+static void metal_io_set_widths(unsigned int widths, uint8_t *ptr,
+				unsigned char value, size_t len)
+{
+	uint8_t word[8];
+	size_t head, n;
+	int width;
+
+	for (; len; ptr += n, len -= n) {
+		width = metal_io_access_width(widths, (uintptr_t)ptr, len);
+		head = (uintptr_t)ptr & (width - 1);
+		n = metal_min(width - head, len);
+		if (n < (size_t)width)
+			metal_io_load(ptr - head, word, width);
+		memset(word + head, value, n);
+		metal_io_store(ptr - head, word, width);
+	}
+}
+
+/* Copy between memory and a directly mapped region. */
+static void metal_io_region_read(struct metal_io_region *io, void *dst,
+				 const void *ptr, size_t len)
+{
+	if (io->access_widths)
+		metal_io_read_widths(io->access_widths, dst, ptr, len);
+	else if (io->stream && len >= METAL_IO_STREAM_THRESHOLD)
+		metal_io_copy->stream_read(dst, ptr, len);
+	else
+		metal_io_copy->copy(dst, ptr, len);
+}
+
+static void metal_io_region_write(struct metal_io_region *io, void *ptr,
+				  const void *src, size_t len)
+{
+	if (io->access_widths)
+		metal_io_write_widths(io->access_widths, ptr, src, len);
+	else if (io->stream && len >= METAL_IO_STREAM_THRESHOLD)
+		metal_io_copy->stream_write(ptr, src, len);
+	else
+		metal_io_copy->copy(ptr, src, len);
+}
+
+struct metal_io_parallel_op {
+	unsigned char		*dst;
+	const unsigned char	*src;
+	unsigned char		value;
+};
+
+static void metal_io_parallel_set(void *arg, size_t offset, size_t len)
+{
+	struct metal_io_parallel_op *op = arg;
+
+	metal_io_copy->set(op->dst + offset, op->value, len);
+}
+
+static void metal_io_parallel_copy(void *arg, size_t offset, size_t len)
+{
+	struct metal_io_parallel_op *op = arg;
+
+	metal_io_copy->copy(op->dst + offset, op->src + offset, len);
+}
+
+/* Run a large operation on a region across threads, 0 if it was done. */
+static int metal_io_parallel(struct metal_io_region *io, size_t len,
+			     metal_io_chunk_fn fn,
+			     struct metal_io_parallel_op *op)
+{
+	if (io->parallel < 2 || len < METAL_IO_PARALLEL_THRESHOLD)
+		return -EINVAL;
+	return metal_sys_io_parallel(op->dst, len, io->parallel, fn, op);
+}
+
+int metal_io_block_read_explicit(struct metal_io_region *io,
+				 unsigned long offset, void *restrict dst,
+				 int len, memory_order order)
 {
 	unsigned char *ptr = metal_io_virt(io, offset);
-	unsigned char *dest = dst;
 	int retlen;
 
 	if (offset > io->size)
@@ -44,34 +686,50 @@ int metal_io_block_read(struct metal_io_region *io, unsigned long offset,
 	retlen = len;
 	if (io->ops.block_read) {
 		retlen = (*io->ops.block_read)(
-			io, offset, dst, memory_order_seq_cst, len);
+			io, offset, dst, order, len);
 	} else {
-		atomic_thread_fence(memory_order_seq_cst);
-		while ( len && (
-			((uintptr_t)dest % sizeof(int)) ||
-			((uintptr_t)ptr % sizeof(int)))) {
-			*(unsigned char *)dest =
-				*(const unsigned char *)ptr;
-			dest++;
-			ptr++;
-			len--;
-		}
-		for (; len >= (int)sizeof(int); dest += sizeof(int),
-					ptr += sizeof(int),
-					len -= sizeof(int))
-			*(unsigned int *)dest = *(const unsigned int *)ptr;
-		for (; len != 0; dest++, ptr++, len--)
-			*(unsigned char *)dest =
-				*(const unsigned char *)ptr;
+		atomic_thread_fence(order);
+		metal_io_region_read(io, dst, ptr, len);
 	}
 	return retlen;
 }
 
-int metal_io_block_write(struct metal_io_region *io, unsigned long offset,
-	       const void *restrict src, int len)
+int metal_io_block_read(struct metal_io_region *io, unsigned long offset,
+	       void *restrict dst, int len)
+{
+	return metal_io_block_read_explicit(io, offset, dst, len,
+					    memory_order_seq_cst);
+}
+
+void metal_io_prefetch(struct metal_io_region *io, unsigned long offset,
+		       size_t len, int for_write)
+{
+	unsigned char *ptr = metal_io_virt(io, offset);
+
+	if (!ptr || !len || !metal_io_copy->prefetch)
+		return;
+	len = metal_min(len, io->size - offset);
+	if (len)
+		metal_io_copy->prefetch(ptr, len, for_write);
+}
+
+int metal_io_block_read_ahead(struct metal_io_region *io,
+			      unsigned long offset, void *restrict dst,
+			      int len, size_t ahead)
+{
+	int ret = metal_io_block_read(io, offset, dst, len);
+
+	if (ret > 0 && ahead)
+		metal_io_prefetch(io, offset + ret, ahead, 0);
+	return ret;
+}
+
+int metal_io_block_write_explicit(struct metal_io_region *io,
+				  unsigned long offset,
+				  const void *restrict src,
+				  int len, memory_order order)
 {
 	unsigned char *ptr = metal_io_virt(io, offset);
-	const unsigned char *source = src;
 	int retlen;
 
 	if (offset > io->size)
@@ -81,33 +739,27 @@ int metal_io_block_write(struct metal_io_region *io, unsigned long offset,
 	retlen = len;
 	if (io->ops.block_write) {
 		retlen = (*io->ops.block_write)(
-			io, offset, src, memory_order_seq_cst, len);
+			io, offset, src, order, len);
 	} else {
-		while ( len && (
-			((uintptr_t)ptr % sizeof(int)) ||
-			((uintptr_t)source % sizeof(int)))) {
-			*(unsigned char *)ptr =
-				*(const unsigned char *)source;
-			ptr++;
-			source++;
-			len--;
-		}
-		for (; len >= (int)sizeof(int); ptr += sizeof(int),
-					source += sizeof(int),
-					len -= sizeof(int))
-			*(unsigned int *)ptr = *(const unsigned int *)source;
-		for (; len != 0; ptr++, source++, len--)
-			*(unsigned char *)ptr =
-				*(const unsigned char *)source;
-		atomic_thread_fence(memory_order_seq_cst);
+		metal_io_region_write(io, ptr, src, len);
+		atomic_thread_fence(order);
 	}
 	return retlen;
 }
 
-int metal_io_block_set(struct metal_io_region *io, unsigned long offset,
-	       unsigned char value, int len)
+int metal_io_block_write(struct metal_io_region *io, unsigned long offset,
+	       const void *restrict src, int len)
+{
+	return metal_io_block_write_explicit(io, offset, src, len,
+					     memory_order_seq_cst);
+}
+
+int metal_io_block_set_explicit(struct metal_io_region *io,
+				unsigned long offset, unsigned char value,
+				int len, memory_order order)
 {
 	unsigned char *ptr = metal_io_virt(io, offset);
+	struct metal_io_parallel_op op;
 	int retlen = len;
 
 	if (offset > io->size)
@@ -117,23 +769,631 @@ int metal_io_block_set(struct metal_io_region *io, unsigned long offset,
 	retlen = len;
 	if (io->ops.block_set) {
 		(*io->ops.block_set)(
-			io, offset, value, memory_order_seq_cst, len);
+			io, offset, value, order, len);
+	} else if (io->access_widths) {
+		metal_io_set_widths(io->access_widths, ptr, value, len);
+		atomic_thread_fence(order);
 	} else {
-		unsigned int cint = value;
-		unsigned int i;
-
-		for (i = 1; i < sizeof(int); i++)
-			cint |= ((unsigned int)value << (8 * i));
-
-		for (; len && ((uintptr_t)ptr % sizeof(int)); ptr++, len--)
-			*(unsigned char *)ptr = (unsigned char) value;
-		for (; len >= (int)sizeof(int); ptr += sizeof(int),
-						len -= sizeof(int))
-			*(unsigned int *)ptr = cint;
-		for (; len != 0; ptr++, len--)
-			*(unsigned char *)ptr = (unsigned char) value;
+		op.dst = ptr;
+		op.value = value;
+		if (metal_io_parallel(io, len, metal_io_parallel_set, &op))
+			metal_io_copy->set(ptr, value, len);
+		atomic_thread_fence(order);
+	}
+	return retlen;
+}
+
+int metal_io_block_set(struct metal_io_region *io, unsigned long offset,
+	       unsigned char value, int len)
+{
+	return metal_io_block_set_explicit(io, offset, value, len,
+					   memory_order_seq_cst);
+}
+
+static uint32_t metal_io_copy_crc32c(void *restrict dst,
+				     const void *restrict src,
+				     size_t len, uint32_t crc)
+{
+	if (metal_io_copy->copy_crc32c)
+		return metal_io_copy->copy_crc32c(dst, src, len, crc);
+	return metal_io_copy_crc32c_generic(dst, src, len, crc);
+}
+
+int metal_io_block_read_crc32c(struct metal_io_region *io,
+			       unsigned long offset, void *restrict dst,
+			       int len, uint32_t *crc)
+{
+	unsigned char *ptr = metal_io_virt(io, offset);
+
+	if (io->ops.block_read || io->access_widths) {
+		/* The data is read by others, checksum it afterwards. */
+		len = metal_io_block_read(io, offset, dst, len);
+		if (len > 0)
+			*crc = ~metal_io_crc32c_generic(dst, len, ~*crc);
+		return len;
+	}
+
+	if (offset > io->size)
+		return -ERANGE;
+	if ((offset + len) > io->size)
+		len = io->size - offset;
+	atomic_thread_fence(memory_order_seq_cst);
+	*crc = ~metal_io_copy_crc32c(dst, ptr, len, ~*crc);
+	return len;
+}
+
+int metal_io_block_write_crc32c(struct metal_io_region *io,
+				unsigned long offset,
+				const void *restrict src,
+				int len, uint32_t *crc)
+{
+	unsigned char *ptr = metal_io_virt(io, offset);
+
+	if (io->ops.block_write || io->access_widths) {
+		len = metal_io_block_write(io, offset, src, len);
+		if (len > 0)
+			*crc = ~metal_io_crc32c_generic(src, len, ~*crc);
+		return len;
+	}
+
+	if (offset > io->size)
+		return -ERANGE;
+	if ((offset + len) > io->size)
+		len = io->size - offset;
+	*crc = ~metal_io_copy_crc32c(ptr, src, len, ~*crc);
+	atomic_thread_fence(memory_order_seq_cst);
+	return len;
+}
+
+/* Stack bounce buffer for block transfers through region ops. */
+#define METAL_IO_BOUNCE_SIZE	256
+
+static void metal_io_copy_swap(void *restrict dst, const void *restrict src,
+			       size_t len, int width)
+{
+	if (metal_io_copy->copy_swap)
+		metal_io_copy->copy_swap(dst, src, len, width);
+	else
+		metal_io_copy_swap_generic(dst, src, len, width);
+}
+
+/* Clamp an element transfer to the region, or return -errno. */
+static int metal_io_elem_len(struct metal_io_region *io, unsigned long offset,
+			     int len, int width)
+{
+	if (width != 2 && width != 4 && width != 8)
+		return -EINVAL;
+	if (len < 0 || len % width)
+		return -EINVAL;
+	if (offset > io->size)
+		return -ERANGE;
+	if ((offset + len) > io->size)
+		len = metal_align_down(io->size - offset, width);
+	return len;
+}
+
+int metal_io_block_read_endian(struct metal_io_region *io,
+			       unsigned long offset, void *restrict dst,
+			       int len, int width)
+{
+	unsigned char *ptr = metal_io_virt(io, offset);
+	unsigned char buf[METAL_IO_BOUNCE_SIZE];
+	unsigned char *d = dst;
+	int chunk, ret, retlen;
+
+	len = metal_io_elem_len(io, offset, len, width);
+	if (len <= 0 || !metal_io_is_swapped(io))
+		return len <= 0 ? len : metal_io_block_read(io, offset, dst, len);
+
+	if (!io->ops.block_read && !io->access_widths) {
+		atomic_thread_fence(memory_order_seq_cst);
+		metal_io_copy_swap(dst, ptr, len, width);
+		return len;
+	}
+
+	for (retlen = 0; retlen < len; retlen += ret) {
+		chunk = metal_min(len - retlen, (int)sizeof(buf));
+		ret = metal_io_block_read(io, offset + retlen, buf, chunk);
+		if (ret > 0)
+			ret = metal_align_down(ret, width);
+		if (ret <= 0)
+			return retlen ? retlen : ret;
+		metal_io_copy_swap(d + retlen, buf, ret, width);
+	}
+	return retlen;
+}
+
+int metal_io_block_write_endian(struct metal_io_region *io,
+				unsigned long offset,
+				const void *restrict src,
+				int len, int width)
+{
+	unsigned char *ptr = metal_io_virt(io, offset);
+	unsigned char buf[METAL_IO_BOUNCE_SIZE];
+	const unsigned char *s = src;
+	int chunk, ret, retlen;
+
+	len = metal_io_elem_len(io, offset, len, width);
+	if (len <= 0 || !metal_io_is_swapped(io))
+		return len <= 0 ? len : metal_io_block_write(io, offset, src, len);
+
+	if (!io->ops.block_write && !io->access_widths) {
+		metal_io_copy_swap(ptr, src, len, width);
+		atomic_thread_fence(memory_order_seq_cst);
+		return len;
+	}
+
+	/* Swap through a bounce buffer, the source is not ours to modify. */
+	for (retlen = 0; retlen < len; retlen += ret) {
+		chunk = metal_min(len - retlen, (int)sizeof(buf));
+		metal_io_copy_swap(buf, s + retlen, chunk, width);
+		ret = metal_io_block_write(io, offset + retlen, buf, chunk);
+		if (ret <= 0)
+			return retlen ? retlen : ret;
+	}
+	return retlen;
+}
+
+int metal_io_block_copy(struct metal_io_region *dst_io, unsigned long dst_off,
+			struct metal_io_region *src_io, unsigned long src_off,
+			int len)
+{
+	unsigned char *dst = metal_io_virt(dst_io, dst_off);
+	unsigned char *src = metal_io_virt(src_io, src_off);
+	unsigned char buf[METAL_IO_BOUNCE_SIZE];
+	int backward, chunk, pos, ret = 0, retlen;
+	struct metal_io_region *dst_root, *src_root;
+	struct metal_io_parallel_op op;
+	int dst_direct, src_direct;
+
+	if (len < 0)
+		return -EINVAL;
+	if (dst_off > dst_io->size || src_off > src_io->size)
+		return -ERANGE;
+	if ((dst_off + len) > dst_io->size)
+		len = dst_io->size - dst_off;
+	if ((src_off + len) > src_io->size)
+		len = src_io->size - src_off;
+
+	/* Regions that need no ops or access width constraints. */
+	dst_direct = !dst_io->ops.block_write && !dst_io->access_widths;
+	src_direct = !src_io->ops.block_read && !src_io->access_widths;
+
+	if (dst_direct && src_direct) {
+		atomic_thread_fence(memory_order_seq_cst);
+		op.dst = dst;
+		op.src = src;
+		if (dst < src + len && src < dst + len)
+			memmove(dst, src, len);
+		else if (metal_io_parallel(dst_io, len, metal_io_parallel_copy,
+					   &op))
+			metal_io_region_write(dst_io, dst, src, len);
+		atomic_thread_fence(memory_order_seq_cst);
+		return len;
+	} else if (dst_direct) {
+		ret = metal_io_block_read(src_io, src_off, dst, len);
+		atomic_thread_fence(memory_order_seq_cst);
+		return ret;
+	} else if (src_direct) {
+		atomic_thread_fence(memory_order_seq_cst);
+		return metal_io_block_write(dst_io, dst_off, src, len);
+	}
+
+	/*
+	 * Copy from the end when moving up within the same region, which
+	 * subregion views resolve to their root region.  Chunks are placed
+	 * by position, so stop at the first short transfer.
+	 */
+	dst_root = dst_io->parent ? dst_io->parent : dst_io;
+	src_root = src_io->parent ? src_io->parent : src_io;
+	backward = dst_root == src_root &&
+		   dst_io->base + dst_off > src_io->base + src_off;
+	for (retlen = 0; retlen < len; retlen += chunk) {
+		chunk = metal_min(len - retlen, (int)sizeof(buf));
+		pos = backward ? len - retlen - chunk : retlen;
+		ret = metal_io_block_read(src_io, src_off + pos, buf, chunk);
+		if (ret != chunk)
+			break;
+		ret = metal_io_block_write(dst_io, dst_off + pos, buf, chunk);
+		if (ret != chunk)
+			break;
+	}
+	return retlen ? retlen : metal_min(ret, 0);
+}
+
+/* Total length of a scatter list, or -EINVAL if it does not fit in io. */
+static int metal_io_sg_len(struct metal_io_region *io, unsigned long offset,
+			   const struct metal_sg *sg, int nents)
+{
+	unsigned long len = 0;
+	int i;
+
+	for (i = 0; i < nents; i++) {
+		if (sg[i].len < 0)
+			return -EINVAL;
+		len += sg[i].len;
+	}
+	if (nents < 0 || len > io->size - offset || len > INT_MAX)
+		return -EINVAL;
+	return len;
+}
+
+/* Whether a span of a region may be handed out as a direct pointer. */
+static int metal_io_span_direct(struct metal_io_region *io)
+{
+	return io->virt != METAL_BAD_VA && !io->ops.block_read &&
+	       !io->ops.block_write &&
+	       io->access_widths == METAL_IO_ACCESS_ANY;
+}
+
+int metal_io_span_get(struct metal_io_region *io, unsigned long offset,
+		      int len, int flags, void **ptr)
+{
+	void *buf;
+	int ret;
+
+	if (len < 0 || offset > io->size || (size_t)len > io->size - offset)
+		return -ERANGE;
+
+	if (metal_io_span_direct(io)) {
 		atomic_thread_fence(memory_order_seq_cst);
+		*ptr = metal_io_virt(io, offset);
+		return 0;
+	}
+
+	if (io->virt == METAL_BAD_VA &&
+	    (((flags & METAL_IO_SPAN_READ) && !io->ops.block_read) ||
+	     ((flags & METAL_IO_SPAN_WRITE) && !io->ops.block_write)))
+		return -EINVAL;
+	buf = metal_allocate_memory(len ? len : 1);
+	if (!buf)
+		return -ENOMEM;
+	if (flags & METAL_IO_SPAN_READ) {
+		ret = metal_io_block_read(io, offset, buf, len);
+		if (ret != len) {
+			metal_free_memory(buf);
+			return ret < 0 ? ret : -EIO;
+		}
+	}
+	*ptr = buf;
+	return 0;
+}
+
+int metal_io_span_put(struct metal_io_region *io, unsigned long offset,
+		      int len, int flags, void *ptr)
+{
+	int ret = 0;
+
+	if (metal_io_span_direct(io)) {
+		if (flags & METAL_IO_SPAN_WRITE)
+			atomic_thread_fence(memory_order_seq_cst);
+		return 0;
+	}
+
+	if (flags & METAL_IO_SPAN_WRITE) {
+		ret = metal_io_block_write(io, offset, ptr, len);
+		if (ret >= 0)
+			ret = ret == len ? 0 : -EIO;
+	}
+	metal_free_memory(ptr);
+	return ret;
+}
+
+int metal_io_block_readv(struct metal_io_region *io, unsigned long offset,
+			 struct metal_sg *sg, int nents)
+{
+	unsigned char *ptr = metal_io_virt(io, offset);
+	memory_order order = memory_order_seq_cst;
+	int i, len, retlen;
+
+	if (offset > io->size)
+		return -ERANGE;
+	retlen = metal_io_sg_len(io, offset, sg, nents);
+	if (retlen < 0)
+		return retlen;
+	if (io->ops.block_readv)
+		return (*io->ops.block_readv)(io, offset, sg, order, nents);
+
+	if (!io->ops.block_read)
+		atomic_thread_fence(order);
+	for (i = 0, retlen = 0; i < nents; i++) {
+		if (io->ops.block_read) {
+			/* Order only the first element of the vector. */
+			len = (*io->ops.block_read)(
+				io, offset + retlen, sg[i].virt,
+				i ? memory_order_relaxed : order, sg[i].len);
+			if (len < 0)
+				return retlen ? retlen : len;
+		} else {
+			len = sg[i].len;
+			metal_io_region_read(io, sg[i].virt, ptr + retlen, len);
+		}
+		retlen += len;
+		/* Stop at a short transfer, later elements would be shifted. */
+		if (len < sg[i].len)
+			break;
+	}
+	return retlen;
+}
+
+int metal_io_block_writev(struct metal_io_region *io, unsigned long offset,
+			  const struct metal_sg *sg, int nents)
+{
+	unsigned char *ptr = metal_io_virt(io, offset);
+	memory_order order = memory_order_seq_cst;
+	int i, len, retlen;
+
+	if (offset > io->size)
+		return -ERANGE;
+	retlen = metal_io_sg_len(io, offset, sg, nents);
+	if (retlen < 0)
+		return retlen;
+	if (io->ops.block_writev)
+		return (*io->ops.block_writev)(io, offset, sg, order, nents);
+
+	for (i = 0, retlen = 0; i < nents; i++) {
+		if (io->ops.block_write) {
+			/* Order only the last element of the vector. */
+			len = (*io->ops.block_write)(
+				io, offset + retlen, sg[i].virt,
+				i == nents - 1 ? order : memory_order_relaxed,
+				sg[i].len);
+			if (len < 0)
+				return retlen ? retlen : len;
+		} else {
+			len = sg[i].len;
+			metal_io_region_write(io, ptr + retlen, sg[i].virt,
+					      len);
+		}
+		retlen += len;
+		/* Stop at a short transfer, later elements would be shifted. */
+		if (len < sg[i].len)
+			break;
+	}
+	if (!io->ops.block_write)
+		atomic_thread_fence(order);
+	return retlen;
+}
+
+/* Total length of a 2D block, or -errno if it does not fit in io. */
+static int metal_io_2d_len(struct metal_io_region *io, unsigned long offset,
+			   size_t io_pitch, size_t buf_pitch,
+			   int width, int height)
+{
+	size_t last;
+
+	if (width < 0 || height < 0 ||
+	    (size_t)width > io_pitch || (size_t)width > buf_pitch)
+		return -EINVAL;
+	if (!width || !height)
+		return 0;
+	if (height > INT_MAX / width)
+		return -EINVAL;
+	if (offset > io->size)
+		return -ERANGE;
+
+	/* Offset of the end of the last row, checked against overflow. */
+	if (io_pitch && (size_t)(height - 1) > (SIZE_MAX - width) / io_pitch)
+		return -ERANGE;
+	last = (size_t)(height - 1) * io_pitch + width;
+	if (last > io->size - offset)
+		return -ERANGE;
+	return width * height;
+}
+
+int metal_io_block_read2d(struct metal_io_region *io, unsigned long offset,
+			  size_t io_pitch, void *restrict dst,
+			  size_t dst_pitch, int width, int height)
+{
+	unsigned char *ptr = metal_io_virt(io, offset);
+	memory_order order = memory_order_seq_cst;
+	unsigned char *d = dst;
+	int len, retlen, row;
+
+	retlen = metal_io_2d_len(io, offset, io_pitch, dst_pitch,
+				 width, height);
+	if (retlen <= 0)
+		return retlen;
+
+	if (!io->ops.block_read)
+		atomic_thread_fence(order);
+	for (row = 0; row < height; row++) {
+		if (io->ops.block_read) {
+			/* Order only the first row of the block. */
+			len = (*io->ops.block_read)(
+				io, offset + row * io_pitch, d + row * dst_pitch,
+				row ? memory_order_relaxed : order, width);
+			if (len < 0)
+				return len;
+		} else {
+			metal_io_region_read(io, d + row * dst_pitch,
+					     ptr + row * io_pitch, width);
+		}
 	}
 	return retlen;
 }
 
+int metal_io_block_write2d(struct metal_io_region *io, unsigned long offset,
+			   size_t io_pitch, const void *restrict src,
+			   size_t src_pitch, int width, int height)
+{
+	unsigned char *ptr = metal_io_virt(io, offset);
+	memory_order order = memory_order_seq_cst;
+	const unsigned char *s = src;
+	int len, retlen, row;
+
+	retlen = metal_io_2d_len(io, offset, io_pitch, src_pitch,
+				 width, height);
+	if (retlen <= 0)
+		return retlen;
+
+	for (row = 0; row < height; row++) {
+		if (io->ops.block_write) {
+			/* Order only the last row of the block. */
+			len = (*io->ops.block_write)(
+				io, offset + row * io_pitch, s + row * src_pitch,
+				row == height - 1 ? order : memory_order_relaxed,
+				width);
+			if (len < 0)
+				return len;
+		} else {
+			metal_io_region_write(io, ptr + row * io_pitch,
+					      s + row * src_pitch, width);
+		}
+	}
+	if (!io->ops.block_write)
+		atomic_thread_fence(order);
+	return retlen;
+}
+
+int metal_io_stream_block_read(struct metal_io_region *io,
+			       unsigned long offset,
+			       void *restrict dst,
+			       memory_order order,
+			       int len)
+{
+	unsigned char *ptr = metal_io_virt(io, offset);
+
+	if (!ptr)
+		return -ERANGE;
+	atomic_thread_fence(order);
+	if (len >= METAL_IO_STREAM_THRESHOLD)
+		metal_io_copy->stream_read(dst, ptr, len);
+	else
+		metal_io_copy->copy(dst, ptr, len);
+	return len;
+}
+
+int metal_io_stream_block_write(struct metal_io_region *io,
+				unsigned long offset,
+				const void *restrict src,
+				memory_order order,
+				int len)
+{
+	unsigned char *ptr = metal_io_virt(io, offset);
+
+	if (!ptr)
+		return -ERANGE;
+	if (len >= METAL_IO_STREAM_THRESHOLD)
+		metal_io_copy->stream_write(ptr, src, len);
+	else
+		metal_io_copy->copy(ptr, src, len);
+	atomic_thread_fence(order);
+	return len;
+}
+
+static int metal_io_batch_one(struct metal_io_region *io,
+			      struct metal_io_batch_op *op)
+{
+	unsigned long polls;
+	uint64_t value;
+
+	if (op->width != 1 && op->width != 2 &&
+	    op->width != 4 && op->width != 8)
+		return -EINVAL;
+	if (op->offset > io->size || io->size - op->offset < (size_t)op->width)
+		return -ERANGE;
+
+	switch (op->type) {
+	case METAL_IO_BATCH_READ:
+		op->result = metal_io_read(io, op->offset,
+					   memory_order_seq_cst, op->width);
+		break;
+	case METAL_IO_BATCH_WRITE:
+		metal_io_write(io, op->offset, op->value,
+			       memory_order_seq_cst, op->width);
+		break;
+	case METAL_IO_BATCH_SET_BITS:
+	case METAL_IO_BATCH_CLEAR_BITS:
+		value = metal_io_read(io, op->offset,
+				      memory_order_seq_cst, op->width);
+		op->result = value;
+		if (op->type == METAL_IO_BATCH_SET_BITS)
+			value |= op->value;
+		else
+			value &= ~op->value;
+		metal_io_write(io, op->offset, value,
+			       memory_order_seq_cst, op->width);
+		break;
+	case METAL_IO_BATCH_POLL:
+		for (polls = 0; ; polls++) {
+			op->result = metal_io_read(io, op->offset,
+						   memory_order_seq_cst,
+						   op->width);
+			if ((op->result & op->mask) == op->value)
+				break;
+			if (op->max_polls && polls + 1 >= op->max_polls)
+				return -ETIMEDOUT;
+			metal_cpu_yield();
+		}
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int metal_io_batch(struct metal_io_region *io, struct metal_io_batch_op *ops,
+		   int nops)
+{
+	int i, error;
+
+	if (nops < 0)
+		return -EINVAL;
+	if (io->ops.batch)
+		return (*io->ops.batch)(io, ops, nops);
+
+	for (i = 0; i < nops; i++) {
+		error = metal_io_batch_one(io, &ops[i]);
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+long long metal_io_wait_for(struct metal_io_region *io, unsigned long offset,
+			    uint64_t mask, uint64_t value, int width,
+			    unsigned long long timeout_ns)
+{
+	unsigned long long start, now, elapsed = 0, slept = 0;
+	unsigned int spins = 1, usec = 1, i;
+
+	if (width != 1 && width != 2 && width != 4 && width != 8)
+		return -EINVAL;
+	if (offset > io->size || io->size - offset < (size_t)width)
+		return -ERANGE;
+
+	start = metal_get_timestamp();
+	while ((metal_io_read(io, offset, memory_order_seq_cst, width) &
+		mask) != value) {
+		now = metal_get_timestamp();
+		elapsed = metal_max(now - start, slept);
+		if (elapsed >= timeout_ns)
+			return -ETIMEDOUT;
+
+		if (spins <= METAL_IO_WAIT_SPIN_MAX) {
+			for (i = 0; i < spins; i++)
+				metal_cpu_yield();
+			spins <<= 1;
+			continue;
+		}
+
+		/* Do not sleep past the deadline. */
+		usec = metal_min(usec, (timeout_ns - elapsed + 999) / 1000);
+		metal_sleep_usec(usec);
+		slept += usec * 1000ULL;
+		usec = metal_min(usec * 2, METAL_IO_WAIT_SLEEP_MAX);
+	}
+
+	now = metal_get_timestamp();
+	return metal_max(now - start, slept);
+}
+
+int metal_io_enable_stream(struct metal_io_region *io)
+{
+	if (io->virt == METAL_BAD_VA || io->ops.read || io->ops.write ||
+	    io->ops.block_read || io->ops.block_write || io->access_widths)
+		return -EINVAL;
+	io->stream = 1;
+	return 0;
+}
@@ -16,8 +16,10 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <metal/alloc.h>
 #include <metal/assert.h>
 #include <metal/compiler.h>
+#include <metal/config.h>
 #include <metal/atomic.h>
 #include <metal/sys.h>
 #include <metal/cpu.h>
@@ -34,6 +36,37 @@ extern "C" {
 #endif
 
 struct metal_io_region;
+struct metal_sg;
+
+/** Register access operations of an I/O batch. */
+enum metal_io_batch_type {
+	METAL_IO_BATCH_READ,		/**< read a register */
+	METAL_IO_BATCH_WRITE,		/**< write value to a register */
+	METAL_IO_BATCH_SET_BITS,	/**< set the bits of value */
+	METAL_IO_BATCH_CLEAR_BITS,	/**< clear the bits of value */
+	METAL_IO_BATCH_POLL,		/**< read until (reg & mask) == value */
+};
+
+/** One register access of an I/O batch. */
+struct metal_io_batch_op {
+	enum metal_io_batch_type type;	/**< access type */
+	int		width;		/**< access width in bytes */
+	unsigned long	offset;		/**< offset into the I/O region */
+	uint64_t	value;		/**< value, bits or expected value */
+	uint64_t	mask;		/**< mask of bits to poll */
+	unsigned long	max_polls;	/**< reads before a poll times out,
+					     0 to poll without limit */
+	uint64_t	result;		/**< register value read, before
+					     modification for set/clear bits */
+};
+
+/** Atomic read-modify-write operations on an I/O region. */
+enum metal_io_rmw_op {
+	METAL_IO_RMW_XCHG,	/**< exchange */
+	METAL_IO_RMW_ADD,	/**< fetch and add */
+	METAL_IO_RMW_OR,	/**< fetch and bitwise or */
+	METAL_IO_RMW_AND,	/**< fetch and bitwise and */
+};
 
 /** Generic I/O operations. */
 struct metal_io_ops {
@@ -62,6 +95,52 @@ struct metal_io_ops {
 				 memory_order order,
 				 int len);
 	void		(*close)(struct metal_io_region *io);
+	int		(*block_readv)(struct metal_io_region *io,
+				unsigned long offset,
+				struct metal_sg *sg,
+				memory_order order,
+				int nents);
+	int		(*block_writev)(struct metal_io_region *io,
+				unsigned long offset,
+				const struct metal_sg *sg,
+				memory_order order,
+				int nents);
+	uint64_t	(*fetch_op)(struct metal_io_region *io,
+				unsigned long offset,
+				enum metal_io_rmw_op op,
+				uint64_t value,
+				memory_order order,
+				int width);
+	int		(*cmpxchg)(struct metal_io_region *io,
+				unsigned long offset,
+				uint64_t *expected,
+				uint64_t desired,
+				memory_order order,
+				int width);
+	int		(*batch)(struct metal_io_region *io,
+				 struct metal_io_batch_op *ops,
+				 int nops);
+};
+
+/** Access widths for block transfers on an I/O region. */
+#define METAL_IO_ACCESS_8	0x1	/**< byte accesses */
+#define METAL_IO_ACCESS_16	0x2	/**< 16 bit accesses */
+#define METAL_IO_ACCESS_32	0x4	/**< 32 bit accesses */
+#define METAL_IO_ACCESS_64	0x8	/**< 64 bit accesses */
+#define METAL_IO_ACCESS_ANY	0x0	/**< no constraint */
+
+/** Byte order of the data in an I/O region. */
+enum metal_io_endian {
+	METAL_IO_ENDIAN_NATIVE,	/**< same as the processor */
+	METAL_IO_ENDIAN_LITTLE,	/**< little endian */
+	METAL_IO_ENDIAN_BIG,	/**< big endian */
+};
+
+/** Physically contiguous extent of an I/O region. */
+struct metal_io_extent {
+	unsigned long		offset;     /**< offset into the I/O region */
+	size_t			size;       /**< size of the extent */
+	metal_phys_addr_t	phys;       /**< physical address of offset */
 };
 
 /** Libmetal I/O region structure. */
@@ -75,12 +154,39 @@ struct metal_io_region {
 	metal_phys_addr_t	page_mask;  /**< page mask of I/O region */
 	unsigned int		mem_flags;  /**< memory attribute of the
 						 I/O region */
+	unsigned int		access_widths; /**< METAL_IO_ACCESS_* widths
+						    allowed for block access,
+						    0 for any */
+	enum metal_io_endian	endian;     /**< byte order of the region */
+	unsigned int		parallel;   /**< threads for large block set
+						 and copy, 0 or 1 for none */
+	int			stream;     /**< large block transfers bypass
+						 the cache */
 	struct metal_io_ops	ops;        /**< I/O region operations */
+	int			direct;     /**< mapped with no read/write ops,
+						 see metal_io_read32_direct() */
+	unsigned int		num_extents; /**< number of physical extents,
+						  0 to use the physmap */
+	struct metal_io_extent	extent;     /**< the only extent when
+						 num_extents is 1 */
+	struct metal_io_extent	*extents;   /**< num_extents extents sorted
+						 by offset, followed by the
+						 same sorted by phys */
+	struct metal_io_region	*parent;    /**< region viewed by a
+						 subregion, or NULL */
+	unsigned long		base;       /**< offset of a subregion
+						 into its parent */
 };
 
 /**
  * @brief	Open a libmetal I/O region.
  *
+ * The physmap is compacted into physically contiguous extents.  A single
+ * extent is kept in the region, more are copied to a table owned by the
+ * region as with metal_io_init_extents(), whose rules apply.  If that table
+ * cannot be allocated, the physmap is referenced and walked page by page
+ * instead, so it must stay valid while the region is open.
+ *
  * @param[in, out]	io		I/O region handle.
  * @param[in]		virt		Virtual address of region.
  * @param[in]		physmap		Array of physical addresses per page.
@@ -95,6 +201,48 @@ metal_io_init(struct metal_io_region *io, void *virt,
 	      unsigned page_shift, unsigned int mem_flags,
 	      const struct metal_io_ops *ops);
 
+/**
+ * @brief	Open a libmetal I/O region described by physical extents.
+ *
+ * The extents are copied, so the caller may release them on return.
+ * Extents need not be sorted, but must not overlap.  More than one extent
+ * is copied to a table owned by the region, which metal_io_finish() frees:
+ * finish the region before opening it again, and use metal_io_subregion()
+ * rather than copying the region structure to share it.
+ *
+ * @param[in, out]	io		I/O region handle.
+ * @param[in]		virt		Virtual address of region.
+ * @param[in]		extents		Array of physically contiguous extents.
+ * @param[in]		num_extents	Number of extents.
+ * @param[in]		size		Size of region.
+ * @param[in]		mem_flags	Memory flags
+ * @param[in]		ops		ops
+ * @return	0 on success, or -errno on failure.
+ */
+int
+metal_io_init_extents(struct metal_io_region *io, void *virt,
+		      const struct metal_io_extent *extents,
+		      unsigned int num_extents, size_t size,
+		      unsigned int mem_flags,
+		      const struct metal_io_ops *ops);
+
+/**
+ * @brief	Open a view of part of an I/O region.
+ *
+ * The child shares the mapping, physical translation and ops of the
+ * parent without allocating, and offsets into it are relative to its own
+ * start.  The parent must stay open while the child is in use.  Closing
+ * the child with metal_io_finish() does not affect the parent.
+ *
+ * @param[in]	parent	I/O region handle, which may itself be a view.
+ * @param[in]	offset	Offset of the view into the parent.
+ * @param[in]	size	Size of the view.
+ * @param[out]	child	I/O region handle of the view.
+ * @return	0 on success, or -ERANGE if the view is not in the parent.
+ */
+int metal_io_subregion(struct metal_io_region *parent, unsigned long offset,
+		       size_t size, struct metal_io_region *child);
+
 /**
  * @brief	Close a libmetal shared memory segment.
  * @param[in]	io	I/O region handle.
@@ -103,6 +251,8 @@ static inline void metal_io_finish(struct metal_io_region *io)
 {
 	if (io->ops.close)
 		(*io->ops.close)(io);
+	if (io->num_extents > 1 && !io->parent)
+		metal_free_memory(io->extents);
 	memset(io, 0, sizeof(*io));
 }
 
@@ -117,6 +267,53 @@ static inline size_t metal_io_region_size(struct metal_io_region *io)
 	return io->size;
 }
 
+/**
+ * @brief	Restrict the access widths used by block transfers.
+ *
+ * Memory that only accepts some transaction sizes, such as device BRAM or
+ * FIFOs, can limit the block read, write and set paths to aligned
+ * accesses of the allowed widths.  The widest width that fits is used,
+ * and partial words at the ends are updated with read-modify-write of the
+ * narrowest allowed width.  The region should be aligned to the widest
+ * allowed width.
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	widths	METAL_IO_ACCESS_* widths or'd together, or
+ *			METAL_IO_ACCESS_ANY.
+ * @return	0 on success, or -EINVAL for unknown widths.
+ */
+int metal_io_set_access_widths(struct metal_io_region *io,
+			       unsigned int widths);
+
+/**
+ * @brief	Set the byte order of the data in an I/O region.
+ *
+ * The byte order is used by metal_io_block_read_endian() and
+ * metal_io_block_write_endian().
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	endian	Byte order of the region.
+ */
+static inline void
+metal_io_set_endian(struct metal_io_region *io, enum metal_io_endian endian)
+{
+	io->endian = endian;
+}
+
+/**
+ * @brief	Check whether data in an I/O region is in reverse byte order.
+ * @param[in]	io	I/O region handle.
+ * @return	1 if elements must be byte swapped, 0 otherwise.
+ */
+static inline int metal_io_is_swapped(struct metal_io_region *io)
+{
+#ifdef METAL_BIG_ENDIAN
+	return io->endian == METAL_IO_ENDIAN_LITTLE;
+#else
+	return io->endian == METAL_IO_ENDIAN_BIG;
+#endif
+}
+
 /**
  * @brief	Get virtual address for a given offset into the I/O region.
  * @param[in]	io	I/O region handle.
@@ -154,11 +351,42 @@ metal_io_virt_to_offset(struct metal_io_region *io, void *virt)
 static inline metal_phys_addr_t
 metal_io_phys(struct metal_io_region *io, unsigned long offset)
 {
-	unsigned long page = (io->page_shift >=
-			     sizeof(offset) * CHAR_BIT ?
-			     0 : offset >> io->page_shift);
-	return (io->physmap != NULL && offset <= io->size
-		? io->physmap[page] + (offset & io->page_mask)
+	const struct metal_io_extent *ext = NULL;
+	unsigned long page, pos;
+
+	if (offset > io->size)
+		return METAL_BAD_PHYS;
+
+	/* Translations are shared with the parent of a subregion. */
+	pos = offset + io->base;
+
+	if (io->num_extents == 1) {
+		ext = &io->extent;
+	} else if (io->num_extents) {
+		unsigned int lo = 0, hi = io->num_extents;
+
+		/* Last extent starting at or before offset. */
+		while (hi - lo > 1) {
+			unsigned int mid = lo + (hi - lo) / 2;
+
+			if (io->extents[mid].offset <= pos)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		ext = &io->extents[lo];
+	} else {
+		page = (io->page_shift >= sizeof(pos) * CHAR_BIT ?
+			0 : pos >> io->page_shift);
+		return (io->physmap != NULL
+			? io->physmap[page] + (pos & io->page_mask)
+			: METAL_BAD_PHYS);
+	}
+
+	/* The end of the region maps to the end of its last extent. */
+	return (pos >= ext->offset && pos - ext->offset <= ext->size &&
+		(pos - ext->offset < ext->size || offset == io->size)
+		? ext->phys + (pos - ext->offset)
 		: METAL_BAD_PHYS);
 }
 
@@ -171,15 +399,46 @@ metal_io_phys(struct metal_io_region *io, unsigned long offset)
 static inline unsigned long
 metal_io_phys_to_offset(struct metal_io_region *io, metal_phys_addr_t phys)
 {
-	unsigned long offset =
-		(io->page_mask == (metal_phys_addr_t)(-1) ?
-		phys - io->physmap[0] :  phys & io->page_mask);
-	do {
-		if (metal_io_phys(io, offset) == phys)
-			return offset;
-		offset += io->page_mask + 1;
-	} while (offset < io->size);
-	return METAL_BAD_OFFSET;
+	const struct metal_io_extent *ext;
+	unsigned long offset;
+
+	if (io->num_extents == 1) {
+		ext = &io->extent;
+	} else if (io->num_extents) {
+		const struct metal_io_extent *by_phys =
+			io->extents + io->num_extents;
+		unsigned int lo = 0, hi = io->num_extents;
+
+		/* Last extent starting at or below phys. */
+		while (hi - lo > 1) {
+			unsigned int mid = lo + (hi - lo) / 2;
+
+			if (by_phys[mid].phys <= phys)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		ext = &by_phys[lo];
+	} else {
+		if (!io->physmap)
+			return METAL_BAD_OFFSET;
+		offset = (io->page_mask == (metal_phys_addr_t)(-1) ?
+			  phys - io->physmap[0] - io->base :
+			  (phys - io->base) & io->page_mask);
+		do {
+			if (metal_io_phys(io, offset) == phys)
+				return offset;
+			offset += io->page_mask + 1;
+		} while (offset < io->size);
+		return METAL_BAD_OFFSET;
+	}
+
+	if (phys < ext->phys || phys - ext->phys >= ext->size)
+		return METAL_BAD_OFFSET;
+	offset = ext->offset + (unsigned long)(phys - ext->phys);
+	return (offset >= io->base && offset - io->base < io->size
+		? offset - io->base
+		: METAL_BAD_OFFSET);
 }
 
 /**
@@ -310,6 +569,275 @@ metal_io_write(struct metal_io_region *io, unsigned long offset,
 #define metal_io_write64(_io, _ofs, _val)				\
 	metal_io_write((_io), (_ofs), (_val), memory_order_seq_cst, 8)
 
+/**
+ * @brief	Check whether an I/O region may use the direct accessors.
+ *
+ * A region is direct when it is mapped at a valid virtual address and was
+ * initialized without read or write operations.
+ *
+ * @param[in]	io	I/O region handle.
+ * @return	1 if the region is direct, 0 otherwise.
+ */
+static inline int metal_io_is_direct(struct metal_io_region *io)
+{
+	return io->direct;
+}
+
+static inline void *
+__metal_io_direct(struct metal_io_region *io, unsigned long offset, int width)
+{
+#ifdef METAL_IO_DEBUG
+	metal_assert(io->direct && offset <= io->size &&
+		     (size_t)width <= io->size - offset);
+#else
+	(void)width;
+#endif
+	return (uint8_t *)io->virt + offset;
+}
+
+/*
+ * Direct accessors skip the ops dispatch and the range check, and compile
+ * to a single access of the given width.  They may only be used on
+ * regions for which metal_io_is_direct() is true; build with
+ * WITH_IO_DEBUG to assert this and check the offset.
+ */
+#define __METAL_IO_DIRECT(_bits, _type, _atype)				\
+static inline _type							\
+metal_io_read##_bits##_direct_explicit(struct metal_io_region *io,	\
+				       unsigned long offset,		\
+				       memory_order order)		\
+{									\
+	(void)order;							\
+	return atomic_load_explicit(					\
+		(_atype *)__metal_io_direct(io, offset, sizeof(_type)),	\
+		order);							\
+}									\
+static inline _type							\
+metal_io_read##_bits##_direct(struct metal_io_region *io,		\
+			      unsigned long offset)			\
+{									\
+	return metal_io_read##_bits##_direct_explicit(			\
+		io, offset, memory_order_seq_cst);			\
+}									\
+static inline void							\
+metal_io_write##_bits##_direct_explicit(struct metal_io_region *io,	\
+					unsigned long offset,		\
+					_type value,			\
+					memory_order order)		\
+{									\
+	(void)order;							\
+	atomic_store_explicit(						\
+		(_atype *)__metal_io_direct(io, offset, sizeof(_type)),	\
+		value, order);						\
+}									\
+static inline void							\
+metal_io_write##_bits##_direct(struct metal_io_region *io,		\
+			       unsigned long offset, _type value)	\
+{									\
+	metal_io_write##_bits##_direct_explicit(			\
+		io, offset, value, memory_order_seq_cst);		\
+}
+
+__METAL_IO_DIRECT(8, uint8_t, atomic_uchar)
+__METAL_IO_DIRECT(16, uint16_t, atomic_ushort)
+__METAL_IO_DIRECT(32, uint32_t, atomic_uint)
+#ifndef NO_ATOMIC_64_SUPPORT
+__METAL_IO_DIRECT(64, uint64_t, atomic_ullong)
+#endif
+
+#ifdef METAL_BIG_ENDIAN
+#define __metal_io_be16(_x)	((uint16_t)(_x))
+#define __metal_io_be32(_x)	((uint32_t)(_x))
+#define __metal_io_be64(_x)	((uint64_t)(_x))
+#define __metal_io_le16(_x)	metal_bswap16((uint16_t)(_x))
+#define __metal_io_le32(_x)	metal_bswap32((uint32_t)(_x))
+#define __metal_io_le64(_x)	metal_bswap64((uint64_t)(_x))
+#else
+#define __metal_io_be16(_x)	metal_bswap16((uint16_t)(_x))
+#define __metal_io_be32(_x)	metal_bswap32((uint32_t)(_x))
+#define __metal_io_be64(_x)	metal_bswap64((uint64_t)(_x))
+#define __metal_io_le16(_x)	((uint16_t)(_x))
+#define __metal_io_le32(_x)	((uint32_t)(_x))
+#define __metal_io_le64(_x)	((uint64_t)(_x))
+#endif
+
+/*
+ * Accessors for registers of a fixed byte order, converting to and from
+ * the processor byte order whatever the endian attribute of the region.
+ */
+#define metal_io_read16be(_io, _ofs)					\
+	__metal_io_be16(metal_io_read16((_io), (_ofs)))
+#define metal_io_write16be(_io, _ofs, _val)				\
+	metal_io_write16((_io), (_ofs), __metal_io_be16(_val))
+#define metal_io_read32be(_io, _ofs)					\
+	__metal_io_be32(metal_io_read32((_io), (_ofs)))
+#define metal_io_write32be(_io, _ofs, _val)				\
+	metal_io_write32((_io), (_ofs), __metal_io_be32(_val))
+#define metal_io_read64be(_io, _ofs)					\
+	__metal_io_be64(metal_io_read64((_io), (_ofs)))
+#define metal_io_write64be(_io, _ofs, _val)				\
+	metal_io_write64((_io), (_ofs), __metal_io_be64(_val))
+
+#define metal_io_read16le(_io, _ofs)					\
+	__metal_io_le16(metal_io_read16((_io), (_ofs)))
+#define metal_io_write16le(_io, _ofs, _val)				\
+	metal_io_write16((_io), (_ofs), __metal_io_le16(_val))
+#define metal_io_read32le(_io, _ofs)					\
+	__metal_io_le32(metal_io_read32((_io), (_ofs)))
+#define metal_io_write32le(_io, _ofs, _val)				\
+	metal_io_write32((_io), (_ofs), __metal_io_le32(_val))
+#define metal_io_read64le(_io, _ofs)					\
+	__metal_io_le64(metal_io_read64((_io), (_ofs)))
+#define metal_io_write64le(_io, _ofs, _val)				\
+	metal_io_write64((_io), (_ofs), __metal_io_le64(_val))
+
+#define __metal_io_fetch_op(_ptr, _op, _val, _order)			\
+	((_op) == METAL_IO_RMW_ADD ?					\
+	 atomic_fetch_add_explicit((_ptr), (_val), (_order)) :		\
+	 (_op) == METAL_IO_RMW_OR ?					\
+	 atomic_fetch_or_explicit((_ptr), (_val), (_order)) :		\
+	 (_op) == METAL_IO_RMW_AND ?					\
+	 atomic_fetch_and_explicit((_ptr), (_val), (_order)) :		\
+	 atomic_exchange_explicit((_ptr), (_val), (_order)))
+
+/**
+ * @brief	Atomically modify a value in an I/O region.
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	op	Operation to apply.
+ * @param[in]	value	Operand of the operation.
+ * @param[in]	order	Memory ordering.
+ * @param[in]	width	Width in bytes of datatype to modify.  This must be 1,
+ *			2, 4, or 8, and a compile time constant for this
+ *			function to inline cleanly.
+ * @return	Value before the operation.
+ */
+static inline uint64_t
+metal_io_fetch_op(struct metal_io_region *io, unsigned long offset,
+		  enum metal_io_rmw_op op, uint64_t value,
+		  memory_order order, int width)
+{
+	void *ptr = metal_io_virt(io, offset);
+
+	if (io->ops.fetch_op)
+		return (*io->ops.fetch_op)(io, offset, op, value, order, width);
+	else if (ptr && sizeof(atomic_uchar) == width)
+		return __metal_io_fetch_op((atomic_uchar *)ptr, op, value,
+					   order);
+	else if (ptr && sizeof(atomic_ushort) == width)
+		return __metal_io_fetch_op((atomic_ushort *)ptr, op, value,
+					   order);
+	else if (ptr && sizeof(atomic_uint) == width)
+		return __metal_io_fetch_op((atomic_uint *)ptr, op, value,
+					   order);
+	else if (ptr && sizeof(atomic_ulong) == width)
+		return __metal_io_fetch_op((atomic_ulong *)ptr, op, value,
+					   order);
+#ifndef NO_ATOMIC_64_SUPPORT
+	else if (ptr && sizeof(atomic_ullong) == width)
+		return __metal_io_fetch_op((atomic_ullong *)ptr, op, value,
+					   order);
+#endif
+	metal_assert(0);
+	return 0; /* quiet compiler */
+}
+
+/**
+ * @brief	Atomically compare and exchange a value in an I/O region.
+ * @param[in]	io		I/O region handle.
+ * @param[in]	offset		Offset into I/O region.
+ * @param[in, out]	expected	Expected value, updated to the current
+ *				value if the exchange fails.
+ * @param[in]	desired		Value to store if the current value matches.
+ * @param[in]	order		Memory ordering.
+ * @param[in]	width		Width in bytes of datatype to modify.  This
+ *				must be 1, 2, 4, or 8, and a compile time
+ *				constant for this function to inline cleanly.
+ * @return	Non-zero if the value was exchanged.
+ */
+static inline int
+metal_io_cmpxchg(struct metal_io_region *io, unsigned long offset,
+		 uint64_t *expected, uint64_t desired,
+		 memory_order order, int width)
+{
+	void *ptr = metal_io_virt(io, offset);
+	memory_order fail = (order == memory_order_release ?
+			     memory_order_relaxed :
+			     order == memory_order_acq_rel ?
+			     memory_order_acquire : order);
+	int ret = 0;
+
+	if (io->ops.cmpxchg) {
+		return (*io->ops.cmpxchg)(io, offset, expected, desired,
+					  order, width);
+	} else if (ptr && sizeof(atomic_uchar) == width) {
+		unsigned char cur = *expected;
+
+		ret = atomic_compare_exchange_strong_explicit(
+			(atomic_uchar *)ptr, &cur, desired, order, fail);
+		*expected = cur;
+	} else if (ptr && sizeof(atomic_ushort) == width) {
+		unsigned short cur = *expected;
+
+		ret = atomic_compare_exchange_strong_explicit(
+			(atomic_ushort *)ptr, &cur, desired, order, fail);
+		*expected = cur;
+	} else if (ptr && sizeof(atomic_uint) == width) {
+		unsigned int cur = *expected;
+
+		ret = atomic_compare_exchange_strong_explicit(
+			(atomic_uint *)ptr, &cur, desired, order, fail);
+		*expected = cur;
+	} else if (ptr && sizeof(atomic_ulong) == width) {
+		unsigned long cur = *expected;
+
+		ret = atomic_compare_exchange_strong_explicit(
+			(atomic_ulong *)ptr, &cur, desired, order, fail);
+		*expected = cur;
+#ifndef NO_ATOMIC_64_SUPPORT
+	} else if (ptr && sizeof(atomic_ullong) == width) {
+		unsigned long long cur = *expected;
+
+		ret = atomic_compare_exchange_strong_explicit(
+			(atomic_ullong *)ptr, &cur, desired, order, fail);
+		*expected = cur;
+#endif
+	} else {
+		metal_assert(0);
+	}
+	return ret;
+}
+
+#define metal_io_exchange(_io, _ofs, _val, _order, _width)		\
+	metal_io_fetch_op((_io), (_ofs), METAL_IO_RMW_XCHG, (_val),	\
+			  (_order), (_width))
+#define metal_io_fetch_add(_io, _ofs, _val, _order, _width)		\
+	metal_io_fetch_op((_io), (_ofs), METAL_IO_RMW_ADD, (_val),	\
+			  (_order), (_width))
+#define metal_io_fetch_or(_io, _ofs, _val, _order, _width)		\
+	metal_io_fetch_op((_io), (_ofs), METAL_IO_RMW_OR, (_val),	\
+			  (_order), (_width))
+#define metal_io_fetch_and(_io, _ofs, _val, _order, _width)		\
+	metal_io_fetch_op((_io), (_ofs), METAL_IO_RMW_AND, (_val),	\
+			  (_order), (_width))
+
+/**
+ * @brief	Read a block from an I/O region, with explicit memory ordering.
+ *
+ * The fence for @p order is issued once, before the block is copied.  Use
+ * memory_order_relaxed for all but the first of a batch of reads.
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	dst	destination to store the read data.
+ * @param[in]	len	length in bytes to read.
+ * @param[in]	order	Memory ordering.
+ * @return      On success, number of bytes read. On failure, negative value
+ */
+int metal_io_block_read_explicit(struct metal_io_region *io,
+				 unsigned long offset, void *restrict dst,
+				 int len, memory_order order);
+
 /**
  * @brief	Read a block from an I/O region.
  * @param[in]	io	I/O region handle.
@@ -321,6 +849,57 @@ metal_io_write(struct metal_io_region *io, unsigned long offset,
 int metal_io_block_read(struct metal_io_region *io, unsigned long offset,
 	       void *restrict dst, int len);
 
+/**
+ * @brief	Start fetching part of an I/O region into the cache.
+ *
+ * Issues software prefetches, one per cache line, across the part of the
+ * range within the region, and returns without waiting for them.  Does
+ * nothing on regions without a virtual mapping, or on processors without
+ * prefetch support.
+ *
+ * @param[in]	io		I/O region handle.
+ * @param[in]	offset		Offset into I/O region.
+ * @param[in]	len		Length in bytes to prefetch.
+ * @param[in]	for_write	Non-zero if the range is about to be written.
+ */
+void metal_io_prefetch(struct metal_io_region *io, unsigned long offset,
+		       size_t len, int for_write);
+
+/**
+ * @brief	Read a block, then prefetch the bytes following it.
+ *
+ * Lets a consumer of back to back messages overlap fetching the next
+ * message with processing the one just read.
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	dst	destination to store the read data.
+ * @param[in]	len	length in bytes to read.
+ * @param[in]	ahead	length in bytes to prefetch after the block.
+ * @return      On success, number of bytes read. On failure, negative value
+ */
+int metal_io_block_read_ahead(struct metal_io_region *io,
+			      unsigned long offset, void *restrict dst,
+			      int len, size_t ahead);
+
+/**
+ * @brief	Write a block into an I/O region, with explicit memory ordering.
+ *
+ * The fence for @p order is issued once, after the block is copied.  Use
+ * memory_order_relaxed for all but the last of a batch of writes.
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	src	source to write.
+ * @param[in]	len	length in bytes to write.
+ * @param[in]	order	Memory ordering.
+ * @return      On success, number of bytes written. On failure, negative value
+ */
+int metal_io_block_write_explicit(struct metal_io_region *io,
+				  unsigned long offset,
+				  const void *restrict src,
+				  int len, memory_order order);
+
 /**
  * @brief	Write a block into an I/O region.
  * @param[in]	io	I/O region handle.
@@ -332,6 +911,19 @@ int metal_io_block_read(struct metal_io_region *io, unsigned long offset,
 int metal_io_block_write(struct metal_io_region *io, unsigned long offset,
 	       const void *restrict src, int len);
 
+/**
+ * @brief	fill a block of an I/O region, with explicit memory ordering.
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	value	value to fill into the block
+ * @param[in]	len	length in bytes to fill.
+ * @param[in]	order	Memory ordering.
+ * @return      On success, number of bytes filled. On failure, negative value
+ */
+int metal_io_block_set_explicit(struct metal_io_region *io,
+				unsigned long offset, unsigned char value,
+				int len, memory_order order);
+
 /**
  * @brief	fill a block of an I/O region.
  * @param[in]	io	I/O region handle.
@@ -343,6 +935,408 @@ int metal_io_block_write(struct metal_io_region *io, unsigned long offset,
 int metal_io_block_set(struct metal_io_region *io, unsigned long offset,
 	       unsigned char value, int len);
 
+/**
+ * @brief	Copy a block from one I/O region to another.
+ *
+ * When both regions are directly mapped the data is copied in a single
+ * pass, otherwise through the block_read/block_write ops of the regions.
+ * The source and destination may be the same region, and may overlap.
+ *
+ * @param[in]	dst_io	Destination I/O region handle.
+ * @param[in]	dst_off	Offset into destination I/O region.
+ * @param[in]	src_io	Source I/O region handle.
+ * @param[in]	src_off	Offset into source I/O region.
+ * @param[in]	len	length in bytes to copy.
+ * @return      On success, number of bytes copied. On failure, negative value
+ */
+int metal_io_block_copy(struct metal_io_region *dst_io, unsigned long dst_off,
+			struct metal_io_region *src_io, unsigned long src_off,
+			int len);
+
+/** Span access flags. */
+#define METAL_IO_SPAN_READ	(1 << 0) /**< span is read by the caller */
+#define METAL_IO_SPAN_WRITE	(1 << 1) /**< span is written by the caller */
+
+/**
+ * @brief	Borrow a range of an I/O region as plain memory.
+ *
+ * Where the range is directly mapped, and the region has no block ops or
+ * access width constraints, the returned pointer is into the region
+ * itself.  Otherwise it is a staging buffer, loaded from the region when
+ * METAL_IO_SPAN_READ is set.  Either way the caller may only access the
+ * range through the pointer until metal_io_span_put().
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	len	Length in bytes of the range.
+ * @param[in]	flags	METAL_IO_SPAN_READ and/or METAL_IO_SPAN_WRITE.
+ * @param[out]	ptr	Borrowed memory.
+ * @return	0 on success, -ERANGE if the range is not in the region, or
+ *		other -errno on failure.
+ */
+int metal_io_span_get(struct metal_io_region *io, unsigned long offset,
+		      int len, int flags, void **ptr);
+
+/**
+ * @brief	Return a range borrowed with metal_io_span_get().
+ *
+ * With METAL_IO_SPAN_WRITE the contents are published to the region: a
+ * staging buffer is written back, and stores through a direct pointer are
+ * ordered before any later access.  The arguments must match the get.
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	len	Length in bytes of the range.
+ * @param[in]	flags	Flags passed to metal_io_span_get().
+ * @param[in]	ptr	Borrowed memory.
+ * @return	0 on success, or -errno if the write back failed.
+ */
+int metal_io_span_put(struct metal_io_region *io, unsigned long offset,
+		      int len, int flags, void *ptr);
+
+/**
+ * @brief	Read a contiguous block of an I/O region into a scatter list.
+ *
+ * The whole range is validated once and a single fence is issued for the
+ * vector.  Only the virt and len members of each element are used.
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	sg	scatter list of destination buffers.
+ * @param[in]	nents	number of scatter list entries.
+ * @return      On success, number of bytes read. On failure, negative value
+ */
+int metal_io_block_readv(struct metal_io_region *io, unsigned long offset,
+			 struct metal_sg *sg, int nents);
+
+/**
+ * @brief	Write a gather list into a contiguous block of an I/O region.
+ *
+ * The whole range is validated once and a single fence is issued for the
+ * vector.  Only the virt and len members of each element are used.
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	sg	gather list of source buffers.
+ * @param[in]	nents	number of gather list entries.
+ * @return      On success, number of bytes written. On failure, negative value
+ */
+int metal_io_block_writev(struct metal_io_region *io, unsigned long offset,
+			  const struct metal_sg *sg, int nents);
+
+/**
+ * @brief	Run a sequence of register accesses on an I/O region.
+ *
+ * The operations are performed in order, each with sequentially consistent
+ * ordering, and the register value read by each is stored in its result.
+ * Processing stops at the first operation that fails.  A region may run
+ * the whole batch at once through the batch member of its ops.
+ *
+ * @param[in]		io	I/O region handle.
+ * @param[in, out]	ops	array of register access operations.
+ * @param[in]		nops	number of operations.
+ * @return	0 on success, -ETIMEDOUT if a poll did not complete,
+ *		-ERANGE if an access is outside the region, or -EINVAL for
+ *		an unknown operation or width.
+ */
+int metal_io_batch(struct metal_io_region *io, struct metal_io_batch_op *ops,
+		   int nops);
+
+/**
+ * @brief	Read a block from an I/O region and checksum it.
+ *
+ * Computes the CRC32C (Castagnoli) of the data while copying it, so the
+ * data is traversed once.
+ *
+ * @param[in]		io	I/O region handle.
+ * @param[in]		offset	Offset into I/O region.
+ * @param[in]		dst	destination to store the read data.
+ * @param[in]		len	length in bytes to read.
+ * @param[in, out]	crc	CRC32C of preceding data, 0 to start, updated
+ *				with the data read.
+ * @return      On success, number of bytes read. On failure, negative value
+ */
+int metal_io_block_read_crc32c(struct metal_io_region *io,
+			       unsigned long offset, void *restrict dst,
+			       int len, uint32_t *crc);
+
+/**
+ * @brief	Write a block into an I/O region and checksum it.
+ *
+ * Computes the CRC32C (Castagnoli) of the data while copying it, so the
+ * data is traversed once.
+ *
+ * @param[in]		io	I/O region handle.
+ * @param[in]		offset	Offset into I/O region.
+ * @param[in]		src	source to write.
+ * @param[in]		len	length in bytes to write.
+ * @param[in, out]	crc	CRC32C of preceding data, 0 to start, updated
+ *				with the data written.
+ * @return      On success, number of bytes written. On failure, negative value
+ */
+int metal_io_block_write_crc32c(struct metal_io_region *io,
+				unsigned long offset,
+				const void *restrict src,
+				int len, uint32_t *crc);
+
+/**
+ * @brief	Read a block of elements converting them to processor byte order.
+ *
+ * Elements are byte swapped in the same pass as the copy when the endian
+ * attribute of the region differs from the processor byte order.
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	dst	destination to store the read data.
+ * @param[in]	len	length in bytes to read, a multiple of width.
+ * @param[in]	width	element width in bytes, 2, 4 or 8.
+ * @return      On success, number of bytes read. On failure, negative value
+ */
+int metal_io_block_read_endian(struct metal_io_region *io,
+			       unsigned long offset, void *restrict dst,
+			       int len, int width);
+
+/**
+ * @brief	Write a block of elements converting them to region byte order.
+ *
+ * Elements are byte swapped in the same pass as the copy when the endian
+ * attribute of the region differs from the processor byte order.
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	src	source to write.
+ * @param[in]	len	length in bytes to write, a multiple of width.
+ * @param[in]	width	element width in bytes, 2, 4 or 8.
+ * @return      On success, number of bytes written. On failure, negative value
+ */
+int metal_io_block_write_endian(struct metal_io_region *io,
+				unsigned long offset,
+				const void *restrict src,
+				int len, int width);
+
+/** Spin for up to this many metal_cpu_yield() calls before sleeping. */
+#ifndef METAL_IO_WAIT_SPIN_MAX
+#define METAL_IO_WAIT_SPIN_MAX		1024
+#endif
+
+/** Longest single sleep, in microseconds, while waiting on a register. */
+#ifndef METAL_IO_WAIT_SLEEP_MAX
+#define METAL_IO_WAIT_SLEEP_MAX		1000
+#endif
+
+/**
+ * @brief	Wait for a register of an I/O region to reach a value.
+ *
+ * Polls until (register & mask) == value.  Between reads the caller first
+ * spins with exponentially growing runs of metal_cpu_yield(), up to
+ * METAL_IO_WAIT_SPIN_MAX, then sleeps with metal_sleep_usec() for
+ * exponentially growing intervals, up to METAL_IO_WAIT_SLEEP_MAX.  Time is
+ * measured with metal_get_timestamp(); where that does not advance, the
+ * requested sleep time is counted instead.
+ *
+ * @param[in]	io		I/O region handle.
+ * @param[in]	offset		Offset into I/O region.
+ * @param[in]	mask		Mask of bits to compare.
+ * @param[in]	value		Expected value of the masked bits.
+ * @param[in]	width		Width in bytes of the register.
+ * @param[in]	timeout_ns	Time in nanoseconds to wait for.
+ * @return	Elapsed time in nanoseconds once the value is seen,
+ *		-ETIMEDOUT on timeout, -ERANGE if out of range, or -EINVAL
+ *		if width is not 1, 2, 4 or 8.
+ */
+long long metal_io_wait_for(struct metal_io_region *io, unsigned long offset,
+			    uint64_t mask, uint64_t value, int width,
+			    unsigned long long timeout_ns);
+
+/**
+ * @brief	Read a two dimensional block from an I/O region.
+ *
+ * Reads height rows of width bytes, each io_pitch bytes apart in the
+ * region, into rows dst_pitch bytes apart in dst.  The whole block is
+ * validated once and a single fence is issued for the transfer.
+ *
+ * @param[in]	io		I/O region handle.
+ * @param[in]	offset		Offset of the first row in the I/O region.
+ * @param[in]	io_pitch	Distance in bytes between rows in the region.
+ * @param[in]	dst		destination to store the read data.
+ * @param[in]	dst_pitch	Distance in bytes between rows in dst.
+ * @param[in]	width		Length in bytes of each row.
+ * @param[in]	height		Number of rows.
+ * @return	On success, number of bytes read. On failure, negative value:
+ *		-ERANGE if the block does not fit in the region, or -EINVAL
+ *		if a pitch is smaller than the width.
+ */
+int metal_io_block_read2d(struct metal_io_region *io, unsigned long offset,
+			  size_t io_pitch, void *restrict dst,
+			  size_t dst_pitch, int width, int height);
+
+/**
+ * @brief	Write a two dimensional block into an I/O region.
+ *
+ * Writes height rows of width bytes, each src_pitch bytes apart in src,
+ * into rows io_pitch bytes apart in the region.  The whole block is
+ * validated once and a single fence is issued for the transfer.
+ *
+ * @param[in]	io		I/O region handle.
+ * @param[in]	offset		Offset of the first row in the I/O region.
+ * @param[in]	io_pitch	Distance in bytes between rows in the region.
+ * @param[in]	src		source to write.
+ * @param[in]	src_pitch	Distance in bytes between rows in src.
+ * @param[in]	width		Length in bytes of each row.
+ * @param[in]	height		Number of rows.
+ * @return	On success, number of bytes written. On failure, negative
+ *		value: -ERANGE if the block does not fit in the region, or
+ *		-EINVAL if a pitch is smaller than the width.
+ */
+int metal_io_block_write2d(struct metal_io_region *io, unsigned long offset,
+			   size_t io_pitch, const void *restrict src,
+			   size_t src_pitch, int width, int height);
+
+/** Block transfers of at least this many bytes stream past the cache. */
+#ifndef METAL_IO_STREAM_THRESHOLD
+#define METAL_IO_STREAM_THRESHOLD	(256 * 1024)
+#endif
+
+/**
+ * @brief	Streaming block read operation for an I/O region.
+ *
+ * Suitable as the block_read member of struct metal_io_ops for directly
+ * mapped regions.  Reads of at least METAL_IO_STREAM_THRESHOLD bytes use
+ * cache bypassing loads where the processor supports them.
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	dst	destination to store the read data.
+ * @param[in]	order	Memory ordering.
+ * @param[in]	len	length in bytes to read.
+ * @return      On success, number of bytes read. On failure, negative value
+ */
+int metal_io_stream_block_read(struct metal_io_region *io,
+			       unsigned long offset,
+			       void *restrict dst,
+			       memory_order order,
+			       int len);
+
+/**
+ * @brief	Streaming block write operation for an I/O region.
+ *
+ * Suitable as the block_write member of struct metal_io_ops for directly
+ * mapped regions.  Writes of at least METAL_IO_STREAM_THRESHOLD bytes use
+ * non-temporal stores, so the destination is not pulled into the cache.
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	offset	Offset into I/O region.
+ * @param[in]	src	source to write.
+ * @param[in]	order	Memory ordering.
+ * @param[in]	len	length in bytes to write.
+ * @return      On success, number of bytes written. On failure, negative value
+ */
+int metal_io_stream_block_write(struct metal_io_region *io,
+				unsigned long offset,
+				const void *restrict src,
+				memory_order order,
+				int len);
+
+/**
+ * @brief	Enable streaming block transfers on an I/O region.
+ *
+ * Block reads and writes of at least METAL_IO_STREAM_THRESHOLD bytes then
+ * bypass the cache, as with metal_io_stream_block_read() and
+ * metal_io_stream_block_write().  The region operations are left alone,
+ * so it stays directly mapped for spans and the other direct paths.
+ *
+ * @param[in]	io	I/O region handle.
+ * @return	0 on success, or -EINVAL if the region is not directly mapped,
+ *		has its own block operations, or restricts its access widths.
+ */
+int metal_io_enable_stream(struct metal_io_region *io);
+
+/** Block set and copy of at least this many bytes may run in parallel. */
+#ifndef METAL_IO_PARALLEL_THRESHOLD
+#define METAL_IO_PARALLEL_THRESHOLD	(32 * 1024 * 1024)
+#endif
+
+/**
+ * @brief	Split large block set and copy operations across threads.
+ *
+ * Block set, and block copy into the region, of at least
+ * METAL_IO_PARALLEL_THRESHOLD bytes are divided between the calling
+ * thread and up to threads - 1 worker threads, on systems that support
+ * it.  Smaller operations, and regions with block ops or access width
+ * constraints, are not affected.
+ *
+ * @param[in]	io	I/O region handle.
+ * @param[in]	threads	Maximum number of threads, 0 or 1 to disable.
+ */
+static inline void
+metal_io_set_parallel(struct metal_io_region *io, unsigned int threads)
+{
+	io->parallel = threads;
+}
+
+#ifdef METAL_INTERNAL
+
+/** Work on the bytes [offset, offset + len) of a parallel operation. */
+typedef void (*metal_io_chunk_fn)(void *arg, size_t offset, size_t len);
+
+/** Memory copy and fill engine used by the default block I/O paths. */
+struct metal_io_copy_ops {
+	const char	*name;
+	void		(*copy)(void *restrict dst,
+				const void *restrict src,
+				size_t len);
+	void		(*set)(void *dst,
+			       unsigned char value,
+			       size_t len);
+	/** Copy with non-temporal stores, including the store fence. */
+	void		(*stream_write)(void *restrict dst,
+					const void *restrict src,
+					size_t len);
+	/** Copy source data that is consumed once, bypassing the cache. */
+	void		(*stream_read)(void *restrict dst,
+				       const void *restrict src,
+				       size_t len);
+	/**
+	 * Copy while updating an unfinalized CRC32C, or NULL to use the
+	 * table driven copy.
+	 */
+	uint32_t	(*copy_crc32c)(void *restrict dst,
+				       const void *restrict src,
+				       size_t len, uint32_t crc);
+	/**
+	 * Copy byte swapping each element of width 2, 4 or 8 bytes, or
+	 * NULL to use the scalar copy.  len is a multiple of width.
+	 */
+	void		(*copy_swap)(void *restrict dst,
+				     const void *restrict src,
+				     size_t len, int width);
+	/**
+	 * Prefetch each cache line of a range, for reading or writing, or
+	 * NULL if not supported.
+	 */
+	void		(*prefetch)(const void *addr, size_t len,
+				    int for_write);
+};
+
+/**
+ * @brief	Get the processor specific block copy engine.
+ *
+ * Implemented per processor, this may probe the running CPU for optional
+ * instruction set extensions.
+ *
+ * @return	Copy engine, or NULL to use the generic word copy.
+ */
+const struct metal_io_copy_ops *metal_processor_io_copy_ops(void);
+
+/**
+ * @brief	Select the block copy engine for the running CPU.
+ *
+ * Called once from metal_init().  Until then the generic word copy is used.
+ */
+void metal_io_copy_init(void);
+
+#endif
+
 #include <metal/system/@PROJECT_SYSTEM@/io.h>
 
 /** @} */
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2018, Xilinx Inc. and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * @file	io_async.c
+ * @brief	Asynchronous block copy engine for libmetal I/O regions.
+ */
+
+#include <errno.h>
+#include <metal/device.h>
+#include <metal/io_async.h>
+#include <metal/utilities.h>
+
+int metal_io_async_init(struct metal_io_async *async,
+			struct metal_device *dev, unsigned int threads)
+{
+	int ret;
+
+	async->ops.submit = NULL;
+	async->ops.close = NULL;
+	async->priv = NULL;
+	async->fd = -1;
+	metal_mutex_init(&async->lock);
+	metal_condition_init(&async->cond);
+	metal_list_init(&async->done);
+	async->pending = 0;
+
+	if (dev && dev->bus->ops.dev_async_init) {
+		ret = dev->bus->ops.dev_async_init(dev->bus, dev, async);
+		if (ret)
+			goto out_deinit;
+	}
+
+	if (!async->ops.submit) {
+		ret = metal_sys_io_async_start(async, threads);
+		if (ret)
+			goto out_deinit;
+	}
+
+	ret = metal_sys_io_async_init(async);
+	if (ret)
+		goto out_close;
+	return 0;
+
+out_close:
+	if (async->ops.close)
+		async->ops.close(async);
+out_deinit:
+	metal_mutex_deinit(&async->lock);
+	return ret;
+}
+
+void metal_io_async_finish(struct metal_io_async *async)
+{
+	if (async->ops.close)
+		async->ops.close(async);
+	metal_sys_io_async_finish(async);
+	metal_mutex_deinit(&async->lock);
+}
+
+int metal_io_async_submit(struct metal_io_async *async,
+			  struct metal_io_async_job *job)
+{
+	int ret;
+
+	if (!job->dst_io || job->len < 0 ||
+	    (job->type == METAL_IO_ASYNC_COPY && !job->src_io) ||
+	    (job->type != METAL_IO_ASYNC_COPY &&
+	     job->type != METAL_IO_ASYNC_SET))
+		return -EINVAL;
+
+	job->result = 0;
+	job->done = 0;
+	metal_mutex_acquire(&async->lock);
+	async->pending++;
+	metal_mutex_release(&async->lock);
+
+	ret = async->ops.submit(async, job);
+	if (ret) {
+		metal_mutex_acquire(&async->lock);
+		async->pending--;
+		metal_mutex_release(&async->lock);
+	}
+	return ret;
+}
+
+void metal_io_async_complete(struct metal_io_async *async,
+			     struct metal_io_async_job *job)
+{
+	metal_mutex_acquire(&async->lock);
+	job->done = 1;
+	metal_list_add_tail(&async->done, &job->node);
+	async->pending--;
+	metal_sys_io_async_notify(async, 1);
+	metal_condition_broadcast(&async->cond);
+	metal_mutex_release(&async->lock);
+}
+
+/* Take a completed job off the queue.  Called with the lock held. */
+static void metal_io_async_take(struct metal_io_async *async,
+				struct metal_io_async_job *job)
+{
+	metal_list_del(&job->node);
+	if (metal_list_is_empty(&async->done))
+		metal_sys_io_async_notify(async, 0);
+}
+
+struct metal_io_async_job *metal_io_async_reap(struct metal_io_async *async)
+{
+	struct metal_io_async_job *job = NULL;
+
+	metal_mutex_acquire(&async->lock);
+	if (!metal_list_is_empty(&async->done)) {
+		job = metal_container_of(metal_list_first(&async->done),
+					 struct metal_io_async_job, node);
+		metal_io_async_take(async, job);
+	}
+	metal_mutex_release(&async->lock);
+	return job;
+}
+
+int metal_io_async_wait(struct metal_io_async *async,
+			struct metal_io_async_job *job)
+{
+	metal_mutex_acquire(&async->lock);
+	while (!job->done)
+		metal_condition_wait(&async->cond, &async->lock);
+	metal_io_async_take(async, job);
+	metal_mutex_release(&async->lock);
+	return job->result;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2018, Xilinx Inc. and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * @file	io_async.h
+ * @brief	Asynchronous block copy engine for libmetal I/O regions.
+ */
+
+#ifndef __METAL_IO_ASYNC__H__
+#define __METAL_IO_ASYNC__H__
+
+#include <metal/condition.h>
+#include <metal/io.h>
+#include <metal/list.h>
+#include <metal/mutex.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \defgroup io_async Asynchronous I/O Interfaces
+ *  @{ */
+
+struct metal_device;
+struct metal_io_async;
+
+/** Asynchronous job types. */
+enum metal_io_async_type {
+	/** Copy len bytes from src_io to dst_io. */
+	METAL_IO_ASYNC_COPY,
+	/** Fill len bytes of dst_io with value. */
+	METAL_IO_ASYNC_SET,
+};
+
+/** Asynchronous block job, owned by the caller until completed. */
+struct metal_io_async_job {
+	enum metal_io_async_type type;   /**< job type */
+	struct metal_io_region	*dst_io; /**< destination region */
+	unsigned long		dst_off; /**< destination offset */
+	struct metal_io_region	*src_io; /**< source region, for copy */
+	unsigned long		src_off; /**< source offset, for copy */
+	unsigned char		value;   /**< fill value, for set */
+	int			len;     /**< length in bytes */
+	int			result;  /**< bytes done or -errno, once
+					      completed */
+	void			*priv;   /**< caller data */
+
+	/* Private, owned by the engine. */
+	int			done;
+	struct metal_list	node;
+};
+
+/** Asynchronous engine backend operations. */
+struct metal_io_async_ops {
+	/** Start a job, calling metal_io_async_complete() when done. */
+	int (*submit)(struct metal_io_async *async,
+		      struct metal_io_async_job *job);
+	/** Finish all started jobs and release the backend. */
+	void (*close)(struct metal_io_async *async);
+};
+
+/**
+ * Asynchronous block copy engine.
+ *
+ * Jobs are carried out by a backend, either provided by a device through
+ * its bus dev_async_init op, such as a DMA engine, or by software worker
+ * threads.  Completed jobs are queued until reaped, and the completion
+ * file descriptor, where the system has one, is readable while any are
+ * queued.  It can be polled, or registered with metal_irq_register(), in
+ * which case the handler must reap the completed jobs.
+ */
+struct metal_io_async {
+	struct metal_io_async_ops ops;     /**< backend operations */
+	void			*priv;     /**< backend data */
+	int			fd;        /**< completion fd, or -1 */
+	metal_mutex_t		lock;      /**< protects the fields below */
+	struct metal_condition	cond;      /**< signals completions */
+	struct metal_list	done;      /**< completed jobs to reap */
+	unsigned int		pending;   /**< jobs submitted, not done */
+};
+
+/**
+ * @brief	Initialize an asynchronous block copy engine.
+ *
+ * @param[out]	async	Engine to initialize.
+ * @param[in]	dev	Device providing the backend, or NULL to use
+ *			software worker threads.
+ * @param[in]	threads	Number of software worker threads.
+ * @return	0 on success, or -errno on failure.
+ */
+int metal_io_async_init(struct metal_io_async *async,
+			struct metal_device *dev, unsigned int threads);
+
+/**
+ * @brief	Finish an asynchronous engine, waiting for submitted jobs.
+ * @param[in]	async	Engine.
+ */
+void metal_io_async_finish(struct metal_io_async *async);
+
+/**
+ * @brief	Get the completion file descriptor of an engine.
+ * @param[in]	async	Engine.
+ * @return	File descriptor, or -1 if the system has none.
+ */
+static inline int metal_io_async_fd(struct metal_io_async *async)
+{
+	return async->fd;
+}
+
+/**
+ * @brief	Submit a job to an asynchronous engine.
+ *
+ * The job, and the memory it refers to, must stay valid until it has been
+ * returned by metal_io_async_reap() or metal_io_async_wait().
+ *
+ * @param[in]	async	Engine.
+ * @param[in]	job	Job to run.
+ * @return	0 on success, or -errno on failure.
+ */
+int metal_io_async_submit(struct metal_io_async *async,
+			  struct metal_io_async_job *job);
+
+/**
+ * @brief	Submit an asynchronous block copy.
+ *
+ * @param[in]	async	Engine.
+ * @param[out]	job	Job to fill in and submit.
+ * @param[in]	dst_io	Destination I/O region.
+ * @param[in]	dst_off	Destination offset.
+ * @param[in]	src_io	Source I/O region.
+ * @param[in]	src_off	Source offset.
+ * @param[in]	len	Number of bytes to copy.
+ * @return	0 on success, or -errno on failure.
+ */
+static inline int
+metal_io_async_copy(struct metal_io_async *async,
+		    struct metal_io_async_job *job,
+		    struct metal_io_region *dst_io, unsigned long dst_off,
+		    struct metal_io_region *src_io, unsigned long src_off,
+		    int len)
+{
+	job->type = METAL_IO_ASYNC_COPY;
+	job->dst_io = dst_io;
+	job->dst_off = dst_off;
+	job->src_io = src_io;
+	job->src_off = src_off;
+	job->len = len;
+	return metal_io_async_submit(async, job);
+}
+
+/**
+ * @brief	Submit an asynchronous block fill.
+ *
+ * @param[in]	async	Engine.
+ * @param[out]	job	Job to fill in and submit.
+ * @param[in]	io	I/O region to fill.
+ * @param[in]	offset	Offset into the region.
+ * @param[in]	value	Byte value to fill with.
+ * @param[in]	len	Number of bytes to fill.
+ * @return	0 on success, or -errno on failure.
+ */
+static inline int
+metal_io_async_set(struct metal_io_async *async,
+		   struct metal_io_async_job *job,
+		   struct metal_io_region *io, unsigned long offset,
+		   unsigned char value, int len)
+{
+	job->type = METAL_IO_ASYNC_SET;
+	job->dst_io = io;
+	job->dst_off = offset;
+	job->src_io = NULL;
+	job->src_off = 0;
+	job->value = value;
+	job->len = len;
+	return metal_io_async_submit(async, job);
+}
+
+/**
+ * @brief	Take the next completed job off an engine, without blocking.
+ * @param[in]	async	Engine.
+ * @return	Completed job, or NULL if none.
+ */
+struct metal_io_async_job *metal_io_async_reap(struct metal_io_async *async);
+
+/**
+ * @brief	Wait for a submitted job to complete, and take it.
+ *
+ * @param[in]	async	Engine.
+ * @param[in]	job	Submitted job, not yet reaped.
+ * @return	Job result, bytes done or -errno.
+ */
+int metal_io_async_wait(struct metal_io_async *async,
+			struct metal_io_async_job *job);
+
+/**
+ * @brief	Queue a job as completed, called by backends.
+ *
+ * @param[in]	async	Engine.
+ * @param[in]	job	Job whose result has been set.
+ */
+void metal_io_async_complete(struct metal_io_async *async,
+			     struct metal_io_async_job *job);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __METAL_IO_ASYNC__H__ */
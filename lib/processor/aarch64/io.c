@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2018, Xilinx Inc. and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * @file	aarch64/io.c
+ * @brief	aarch64 block copy engine for libmetal I/O regions.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <arm_neon.h>
+#ifdef __ARM_FEATURE_CRC32
+#include <arm_acle.h>
+#endif
+#include <metal/io.h>
+
+/*
+ * Copies shorter than one vector use two overlapping scalar accesses of the
+ * largest width that fits, so no byte loop is needed for any alignment.
+ */
+static inline void metal_aarch64_copy_small(uint8_t *dst, const uint8_t *src,
+					    size_t len)
+{
+	if (len >= 8) {
+		uint64_t head, tail;
+
+		memcpy(&head, src, 8);
+		memcpy(&tail, src + len - 8, 8);
+		memcpy(dst, &head, 8);
+		memcpy(dst + len - 8, &tail, 8);
+	} else if (len >= 4) {
+		uint32_t head, tail;
+
+		memcpy(&head, src, 4);
+		memcpy(&tail, src + len - 4, 4);
+		memcpy(dst, &head, 4);
+		memcpy(dst + len - 4, &tail, 4);
+	} else if (len >= 2) {
+		uint16_t head, tail;
+
+		memcpy(&head, src, 2);
+		memcpy(&tail, src + len - 2, 2);
+		memcpy(dst, &head, 2);
+		memcpy(dst + len - 2, &tail, 2);
+	} else if (len) {
+		*dst = *src;
+	}
+}
+
+static inline void metal_aarch64_set_small(uint8_t *dst, unsigned char value,
+					   size_t len)
+{
+	uint64_t pattern = value * 0x0101010101010101ULL;
+
+	if (len >= 8) {
+		memcpy(dst, &pattern, 8);
+		memcpy(dst + len - 8, &pattern, 8);
+	} else if (len >= 4) {
+		memcpy(dst, &pattern, 4);
+		memcpy(dst + len - 4, &pattern, 4);
+	} else if (len >= 2) {
+		memcpy(dst, &pattern, 2);
+		memcpy(dst + len - 2, &pattern, 2);
+	} else if (len) {
+		*dst = value;
+	}
+}
+
+static void metal_aarch64_copy_neon(void *restrict dst,
+				    const void *restrict src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t head;
+
+	if (len < 16) {
+		metal_aarch64_copy_small(d, s, len);
+		return;
+	}
+
+	/* Unaligned first vector, then continue from an aligned destination. */
+	vst1q_u8(d, vld1q_u8(s));
+	head = 16 - ((uintptr_t)d & 15);
+	d += head;
+	s += head;
+	len -= head;
+
+	for (; len >= 64; d += 64, s += 64, len -= 64) {
+		uint8x16_t v0 = vld1q_u8(s);
+		uint8x16_t v1 = vld1q_u8(s + 16);
+		uint8x16_t v2 = vld1q_u8(s + 32);
+		uint8x16_t v3 = vld1q_u8(s + 48);
+
+		vst1q_u8(d, v0);
+		vst1q_u8(d + 16, v1);
+		vst1q_u8(d + 32, v2);
+		vst1q_u8(d + 48, v3);
+	}
+	for (; len >= 16; d += 16, s += 16, len -= 16)
+		vst1q_u8(d, vld1q_u8(s));
+
+	/* Unaligned last vector, overlapping bytes already copied. */
+	if (len)
+		vst1q_u8(d + len - 16, vld1q_u8(s + len - 16));
+}
+
+static void metal_aarch64_set_neon(void *dst, unsigned char value, size_t len)
+{
+	uint8x16_t v = vdupq_n_u8(value);
+	uint8_t *d = dst;
+	size_t head;
+
+	if (len < 16) {
+		metal_aarch64_set_small(d, value, len);
+		return;
+	}
+
+	vst1q_u8(d, v);
+	head = 16 - ((uintptr_t)d & 15);
+	d += head;
+	len -= head;
+
+	for (; len >= 64; d += 64, len -= 64) {
+		vst1q_u8(d, v);
+		vst1q_u8(d + 16, v);
+		vst1q_u8(d + 32, v);
+		vst1q_u8(d + 48, v);
+	}
+	for (; len >= 16; d += 16, len -= 16)
+		vst1q_u8(d, v);
+
+	if (len)
+		vst1q_u8(d + len - 16, v);
+}
+
+/*
+ * LDNP/STNP hint that the data will not be reused.  The copy is bracketed
+ * by the caller's DMB, which also orders the non-temporal accesses.
+ */
+static inline void metal_aarch64_ldnp(const uint8_t *src, uint8x16_t *v0,
+				      uint8x16_t *v1)
+{
+	asm volatile("ldnp %q0, %q1, [%2]"
+		     : "=w"(*v0), "=w"(*v1) : "r"(src) : "memory");
+}
+
+static inline void metal_aarch64_stnp(uint8_t *dst, uint8x16_t v0,
+				      uint8x16_t v1)
+{
+	asm volatile("stnp %q1, %q2, [%0]"
+		     : : "r"(dst), "w"(v0), "w"(v1) : "memory");
+}
+
+static void metal_aarch64_stream_write_neon(void *restrict dst,
+					    const void *restrict src,
+					    size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t head;
+
+	if (len < 32) {
+		metal_aarch64_copy_neon(d, s, len);
+		return;
+	}
+
+	vst1q_u8(d, vld1q_u8(s));
+	head = 16 - ((uintptr_t)d & 15);
+	d += head;
+	s += head;
+	len -= head;
+
+	for (; len >= 32; d += 32, s += 32, len -= 32)
+		metal_aarch64_stnp(d, vld1q_u8(s), vld1q_u8(s + 16));
+
+	metal_aarch64_copy_neon(d, s, len);
+}
+
+static void metal_aarch64_stream_read_neon(void *restrict dst,
+					   const void *restrict src,
+					   size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	uint8x16_t v0, v1;
+
+	for (; len >= 32; d += 32, s += 32, len -= 32) {
+		metal_aarch64_ldnp(s, &v0, &v1);
+		vst1q_u8(d, v0);
+		vst1q_u8(d + 16, v1);
+	}
+
+	metal_aarch64_copy_neon(d, s, len);
+}
+
+static void metal_aarch64_copy_swap_neon(void *restrict dst,
+					const void *restrict src,
+					size_t len, int width)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	uint8x16_t v;
+	size_t i;
+
+	for (; len >= 16; d += 16, s += 16, len -= 16) {
+		v = vld1q_u8(s);
+		if (width == 8)
+			v = vrev64q_u8(v);
+		else if (width == 4)
+			v = vrev32q_u8(v);
+		else
+			v = vrev16q_u8(v);
+		vst1q_u8(d, v);
+	}
+
+	/* Remaining whole elements. */
+	for (; len; d += width, s += width, len -= width)
+		for (i = 0; i < (size_t)width; i++)
+			d[i] = s[width - 1 - i];
+}
+
+#ifdef __ARM_FEATURE_CRC32
+/* Copy while folding each word into the CRC with the CRC32 extension. */
+static uint32_t metal_aarch64_copy_crc32c(void *restrict dst,
+					  const void *restrict src,
+					  size_t len, uint32_t crc)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	uint64_t v0, v1;
+
+	for (; len >= 16; d += 16, s += 16, len -= 16) {
+		memcpy(&v0, s, 8);
+		memcpy(&v1, s + 8, 8);
+		memcpy(d, &v0, 8);
+		memcpy(d + 8, &v1, 8);
+		crc = __crc32cd(crc, v0);
+		crc = __crc32cd(crc, v1);
+	}
+	for (; len; d++, s++, len--) {
+		*d = *s;
+		crc = __crc32cb(crc, *s);
+	}
+	return crc;
+}
+#endif
+
+/* Smallest data cache line size, from CTR_EL0 when the engine is selected. */
+static size_t metal_aarch64_cache_line = 64;
+
+static void metal_aarch64_prefetch(const void *addr, size_t len,
+				   int for_write)
+{
+	const size_t line = metal_aarch64_cache_line;
+	const uint8_t *p = (const uint8_t *)((uintptr_t)addr & ~(line - 1));
+	const uint8_t *end = (const uint8_t *)addr + len;
+
+	if (for_write)
+		for (; p < end; p += line)
+			asm volatile("prfm pstl1keep, [%0]" : : "r"(p));
+	else
+		for (; p < end; p += line)
+			asm volatile("prfm pldl1keep, [%0]" : : "r"(p));
+}
+
+static const struct metal_io_copy_ops metal_aarch64_copy_neon_ops = {
+	.name		= "neon",
+	.copy		= metal_aarch64_copy_neon,
+	.set		= metal_aarch64_set_neon,
+	.stream_write	= metal_aarch64_stream_write_neon,
+	.stream_read	= metal_aarch64_stream_read_neon,
+	.copy_swap	= metal_aarch64_copy_swap_neon,
+	.prefetch	= metal_aarch64_prefetch,
+#ifdef __ARM_FEATURE_CRC32
+	.copy_crc32c	= metal_aarch64_copy_crc32c,
+#endif
+};
+
+const struct metal_io_copy_ops *metal_processor_io_copy_ops(void)
+{
+	uint64_t ctr;
+
+	/* DminLine is the log2 of the line size in 4 byte words. */
+	asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+	metal_aarch64_cache_line = 4 << ((ctr >> 16) & 0xf);
+
+	/* Advanced SIMD is mandatory on ARMv8-A. */
+	return &metal_aarch64_copy_neon_ops;
+}
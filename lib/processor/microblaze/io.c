@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2018, Xilinx Inc. and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * @file	microblaze/io.c
+ * @brief	microblaze block copy engine for libmetal I/O regions.
+ */
+
+#include <metal/io.h>
+
+const struct metal_io_copy_ops *metal_processor_io_copy_ops(void)
+{
+	/* Use the generic word copy. */
+	return NULL;
+}
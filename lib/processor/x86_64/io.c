@@ -0,0 +1,511 @@
+/*
+ * Copyright (c) 2018, Xilinx Inc. and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * @file	x86_64/io.c
+ * @brief	x86_64 block copy engines for libmetal I/O regions.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <cpuid.h>
+#include <immintrin.h>
+#include <metal/io.h>
+
+/*
+ * Copies shorter than one vector use two overlapping scalar accesses of the
+ * largest width that fits, so no byte loop is needed for any alignment.
+ */
+static inline void metal_x86_copy_small(uint8_t *dst, const uint8_t *src,
+					size_t len)
+{
+	if (len >= 8) {
+		uint64_t head, tail;
+
+		memcpy(&head, src, 8);
+		memcpy(&tail, src + len - 8, 8);
+		memcpy(dst, &head, 8);
+		memcpy(dst + len - 8, &tail, 8);
+	} else if (len >= 4) {
+		uint32_t head, tail;
+
+		memcpy(&head, src, 4);
+		memcpy(&tail, src + len - 4, 4);
+		memcpy(dst, &head, 4);
+		memcpy(dst + len - 4, &tail, 4);
+	} else if (len >= 2) {
+		uint16_t head, tail;
+
+		memcpy(&head, src, 2);
+		memcpy(&tail, src + len - 2, 2);
+		memcpy(dst, &head, 2);
+		memcpy(dst + len - 2, &tail, 2);
+	} else if (len) {
+		*dst = *src;
+	}
+}
+
+static inline void metal_x86_set_small(uint8_t *dst, unsigned char value,
+				       size_t len)
+{
+	uint64_t pattern = value * 0x0101010101010101ULL;
+
+	if (len >= 8) {
+		memcpy(dst, &pattern, 8);
+		memcpy(dst + len - 8, &pattern, 8);
+	} else if (len >= 4) {
+		memcpy(dst, &pattern, 4);
+		memcpy(dst + len - 4, &pattern, 4);
+	} else if (len >= 2) {
+		memcpy(dst, &pattern, 2);
+		memcpy(dst + len - 2, &pattern, 2);
+	} else if (len) {
+		*dst = value;
+	}
+}
+
+static void metal_x86_copy_sse2(void *restrict dst, const void *restrict src,
+				size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t head;
+
+	if (len < 16) {
+		metal_x86_copy_small(d, s, len);
+		return;
+	}
+
+	/* Unaligned first vector, then continue from an aligned destination. */
+	_mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+	head = 16 - ((uintptr_t)d & 15);
+	d += head;
+	s += head;
+	len -= head;
+
+	for (; len >= 64; d += 64, s += 64, len -= 64) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)s);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i *)(s + 32));
+		__m128i v3 = _mm_loadu_si128((const __m128i *)(s + 48));
+
+		_mm_store_si128((__m128i *)d, v0);
+		_mm_store_si128((__m128i *)(d + 16), v1);
+		_mm_store_si128((__m128i *)(d + 32), v2);
+		_mm_store_si128((__m128i *)(d + 48), v3);
+	}
+	for (; len >= 16; d += 16, s += 16, len -= 16)
+		_mm_store_si128((__m128i *)d,
+				_mm_loadu_si128((const __m128i *)s));
+
+	/* Unaligned last vector, overlapping bytes already copied. */
+	if (len)
+		_mm_storeu_si128((__m128i *)(d + len - 16),
+				 _mm_loadu_si128((const __m128i *)
+						 (s + len - 16)));
+}
+
+static void metal_x86_set_sse2(void *dst, unsigned char value, size_t len)
+{
+	__m128i v = _mm_set1_epi8((char)value);
+	uint8_t *d = dst;
+	size_t head;
+
+	if (len < 16) {
+		metal_x86_set_small(d, value, len);
+		return;
+	}
+
+	_mm_storeu_si128((__m128i *)d, v);
+	head = 16 - ((uintptr_t)d & 15);
+	d += head;
+	len -= head;
+
+	for (; len >= 64; d += 64, len -= 64) {
+		_mm_store_si128((__m128i *)d, v);
+		_mm_store_si128((__m128i *)(d + 16), v);
+		_mm_store_si128((__m128i *)(d + 32), v);
+		_mm_store_si128((__m128i *)(d + 48), v);
+	}
+	for (; len >= 16; d += 16, len -= 16)
+		_mm_store_si128((__m128i *)d, v);
+
+	if (len)
+		_mm_storeu_si128((__m128i *)(d + len - 16), v);
+}
+
+__attribute__((target("avx2")))
+static void metal_x86_copy_avx2(void *restrict dst, const void *restrict src,
+				size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t head;
+
+	if (len < 32) {
+		metal_x86_copy_sse2(d, s, len);
+		return;
+	}
+
+	_mm256_storeu_si256((__m256i *)d,
+			    _mm256_loadu_si256((const __m256i *)s));
+	head = 32 - ((uintptr_t)d & 31);
+	d += head;
+	s += head;
+	len -= head;
+
+	for (; len >= 128; d += 128, s += 128, len -= 128) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i *)s);
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)(s + 32));
+		__m256i v2 = _mm256_loadu_si256((const __m256i *)(s + 64));
+		__m256i v3 = _mm256_loadu_si256((const __m256i *)(s + 96));
+
+		_mm256_store_si256((__m256i *)d, v0);
+		_mm256_store_si256((__m256i *)(d + 32), v1);
+		_mm256_store_si256((__m256i *)(d + 64), v2);
+		_mm256_store_si256((__m256i *)(d + 96), v3);
+	}
+	for (; len >= 32; d += 32, s += 32, len -= 32)
+		_mm256_store_si256((__m256i *)d,
+				   _mm256_loadu_si256((const __m256i *)s));
+
+	if (len)
+		_mm256_storeu_si256((__m256i *)(d + len - 32),
+				    _mm256_loadu_si256((const __m256i *)
+						       (s + len - 32)));
+}
+
+__attribute__((target("avx2")))
+static void metal_x86_set_avx2(void *dst, unsigned char value, size_t len)
+{
+	__m256i v = _mm256_set1_epi8((char)value);
+	uint8_t *d = dst;
+	size_t head;
+
+	if (len < 32) {
+		metal_x86_set_sse2(d, value, len);
+		return;
+	}
+
+	_mm256_storeu_si256((__m256i *)d, v);
+	head = 32 - ((uintptr_t)d & 31);
+	d += head;
+	len -= head;
+
+	for (; len >= 128; d += 128, len -= 128) {
+		_mm256_store_si256((__m256i *)d, v);
+		_mm256_store_si256((__m256i *)(d + 32), v);
+		_mm256_store_si256((__m256i *)(d + 64), v);
+		_mm256_store_si256((__m256i *)(d + 96), v);
+	}
+	for (; len >= 32; d += 32, len -= 32)
+		_mm256_store_si256((__m256i *)d, v);
+
+	if (len)
+		_mm256_storeu_si256((__m256i *)(d + len - 32), v);
+}
+
+/*
+ * Non-temporal stores write combine straight to memory.  They are weakly
+ * ordered, so finish with a store fence before the caller's own fence.
+ */
+static void metal_x86_stream_write_sse2(void *restrict dst,
+					const void *restrict src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t head;
+
+	if (len < 16) {
+		metal_x86_copy_small(d, s, len);
+		return;
+	}
+
+	_mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+	head = 16 - ((uintptr_t)d & 15);
+	d += head;
+	s += head;
+	len -= head;
+
+	for (; len >= 64; d += 64, s += 64, len -= 64) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)s);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i *)(s + 32));
+		__m128i v3 = _mm_loadu_si128((const __m128i *)(s + 48));
+
+		_mm_stream_si128((__m128i *)d, v0);
+		_mm_stream_si128((__m128i *)(d + 16), v1);
+		_mm_stream_si128((__m128i *)(d + 32), v2);
+		_mm_stream_si128((__m128i *)(d + 48), v3);
+	}
+	for (; len >= 16; d += 16, s += 16, len -= 16)
+		_mm_stream_si128((__m128i *)d,
+				 _mm_loadu_si128((const __m128i *)s));
+	_mm_sfence();
+
+	if (len)
+		_mm_storeu_si128((__m128i *)(d + len - 16),
+				 _mm_loadu_si128((const __m128i *)
+						 (s + len - 16)));
+}
+
+/*
+ * Ordinary write-back memory ignores the non-temporal load hint, so read
+ * ahead with NTA prefetches instead to keep the source out of the outer
+ * cache levels.
+ */
+static void metal_x86_stream_read_sse2(void *restrict dst,
+				       const void *restrict src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+
+	for (; len >= 64; d += 64, s += 64, len -= 64) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)s);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i *)(s + 32));
+		__m128i v3 = _mm_loadu_si128((const __m128i *)(s + 48));
+
+		_mm_prefetch((const char *)(s + 512), _MM_HINT_NTA);
+		_mm_storeu_si128((__m128i *)d, v0);
+		_mm_storeu_si128((__m128i *)(d + 16), v1);
+		_mm_storeu_si128((__m128i *)(d + 32), v2);
+		_mm_storeu_si128((__m128i *)(d + 48), v3);
+	}
+	metal_x86_copy_sse2(d, s, len);
+}
+
+__attribute__((target("avx2")))
+static void metal_x86_stream_write_avx2(void *restrict dst,
+					const void *restrict src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t head;
+
+	if (len < 32) {
+		metal_x86_copy_sse2(d, s, len);
+		return;
+	}
+
+	_mm256_storeu_si256((__m256i *)d,
+			    _mm256_loadu_si256((const __m256i *)s));
+	head = 32 - ((uintptr_t)d & 31);
+	d += head;
+	s += head;
+	len -= head;
+
+	for (; len >= 128; d += 128, s += 128, len -= 128) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i *)s);
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)(s + 32));
+		__m256i v2 = _mm256_loadu_si256((const __m256i *)(s + 64));
+		__m256i v3 = _mm256_loadu_si256((const __m256i *)(s + 96));
+
+		_mm256_stream_si256((__m256i *)d, v0);
+		_mm256_stream_si256((__m256i *)(d + 32), v1);
+		_mm256_stream_si256((__m256i *)(d + 64), v2);
+		_mm256_stream_si256((__m256i *)(d + 96), v3);
+	}
+	for (; len >= 32; d += 32, s += 32, len -= 32)
+		_mm256_stream_si256((__m256i *)d,
+				    _mm256_loadu_si256((const __m256i *)s));
+	_mm_sfence();
+
+	if (len)
+		_mm256_storeu_si256((__m256i *)(d + len - 32),
+				    _mm256_loadu_si256((const __m256i *)
+						       (s + len - 32)));
+}
+
+__attribute__((target("avx2")))
+static void metal_x86_stream_read_avx2(void *restrict dst,
+				       const void *restrict src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+
+	for (; len >= 128; d += 128, s += 128, len -= 128) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i *)s);
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)(s + 32));
+		__m256i v2 = _mm256_loadu_si256((const __m256i *)(s + 64));
+		__m256i v3 = _mm256_loadu_si256((const __m256i *)(s + 96));
+
+		_mm_prefetch((const char *)(s + 512), _MM_HINT_NTA);
+		_mm_prefetch((const char *)(s + 576), _MM_HINT_NTA);
+		_mm256_storeu_si256((__m256i *)d, v0);
+		_mm256_storeu_si256((__m256i *)(d + 32), v1);
+		_mm256_storeu_si256((__m256i *)(d + 64), v2);
+		_mm256_storeu_si256((__m256i *)(d + 96), v3);
+	}
+	metal_x86_copy_avx2(d, s, len);
+}
+
+/*
+ * Copy while folding each word into the CRC, so the data is checksummed
+ * while it is still in registers.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t metal_x86_copy_crc32c_sse42(void *restrict dst,
+					    const void *restrict src,
+					    size_t len, uint32_t crc)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	uint64_t c = crc, v0, v1;
+
+	for (; len >= 16; d += 16, s += 16, len -= 16) {
+		memcpy(&v0, s, 8);
+		memcpy(&v1, s + 8, 8);
+		memcpy(d, &v0, 8);
+		memcpy(d + 8, &v1, 8);
+		c = _mm_crc32_u64(c, v0);
+		c = _mm_crc32_u64(c, v1);
+	}
+	if (len >= 8) {
+		memcpy(&v0, s, 8);
+		memcpy(d, &v0, 8);
+		c = _mm_crc32_u64(c, v0);
+		d += 8;
+		s += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)c;
+	for (; len; d++, s++, len--) {
+		*d = *s;
+		crc = _mm_crc32_u8(crc, *s);
+	}
+	return crc;
+}
+
+/* Shuffle control reversing the bytes of each 2, 4 or 8 byte element. */
+static inline __m128i metal_x86_swap_mask(int width)
+{
+	switch (width) {
+	case 8:
+		return _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+				    0, 1, 2, 3, 4, 5, 6, 7);
+	case 4:
+		return _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+				    4, 5, 6, 7, 0, 1, 2, 3);
+	default:
+		return _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9,
+				    6, 7, 4, 5, 2, 3, 0, 1);
+	}
+}
+
+__attribute__((target("ssse3")))
+static void metal_x86_copy_swap_ssse3(void *restrict dst,
+				      const void *restrict src,
+				      size_t len, int width)
+{
+	__m128i mask = metal_x86_swap_mask(width);
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t i;
+
+	for (; len >= 64; d += 64, s += 64, len -= 64) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)s);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i *)(s + 32));
+		__m128i v3 = _mm_loadu_si128((const __m128i *)(s + 48));
+
+		_mm_storeu_si128((__m128i *)d, _mm_shuffle_epi8(v0, mask));
+		_mm_storeu_si128((__m128i *)(d + 16),
+				 _mm_shuffle_epi8(v1, mask));
+		_mm_storeu_si128((__m128i *)(d + 32),
+				 _mm_shuffle_epi8(v2, mask));
+		_mm_storeu_si128((__m128i *)(d + 48),
+				 _mm_shuffle_epi8(v3, mask));
+	}
+	for (; len >= 16; d += 16, s += 16, len -= 16)
+		_mm_storeu_si128((__m128i *)d,
+				 _mm_shuffle_epi8(
+					_mm_loadu_si128((const __m128i *)s),
+					mask));
+
+	/* Remaining whole elements. */
+	for (; len; d += width, s += width, len -= width)
+		for (i = 0; i < (size_t)width; i++)
+			d[i] = s[width - 1 - i];
+}
+
+/* Cache line size, from CPUID when the engine is selected. */
+static size_t metal_x86_cache_line = 64;
+
+/*
+ * PREFETCHW fetches the line in exclusive state, saving the ownership
+ * request on the first store.  Processors without it execute a NOP.
+ */
+static void metal_x86_prefetch(const void *addr, size_t len, int for_write)
+{
+	const size_t line = metal_x86_cache_line;
+	const uint8_t *p = (const uint8_t *)((uintptr_t)addr & ~(line - 1));
+	const uint8_t *end = (const uint8_t *)addr + len;
+
+	if (for_write)
+		for (; p < end; p += line)
+			asm volatile("prefetchw %0" : : "m"(*p));
+	else
+		for (; p < end; p += line)
+			_mm_prefetch((const char *)p, _MM_HINT_T0);
+}
+
+static const struct metal_io_copy_ops metal_x86_copy_sse2_ops = {
+	.name		= "sse2",
+	.copy		= metal_x86_copy_sse2,
+	.set		= metal_x86_set_sse2,
+	.stream_write	= metal_x86_stream_write_sse2,
+	.stream_read	= metal_x86_stream_read_sse2,
+	.prefetch	= metal_x86_prefetch,
+};
+
+static const struct metal_io_copy_ops metal_x86_copy_sse42_ops = {
+	.name		= "sse4.2",
+	.copy		= metal_x86_copy_sse2,
+	.set		= metal_x86_set_sse2,
+	.stream_write	= metal_x86_stream_write_sse2,
+	.stream_read	= metal_x86_stream_read_sse2,
+	.copy_crc32c	= metal_x86_copy_crc32c_sse42,
+	.copy_swap	= metal_x86_copy_swap_ssse3,
+	.prefetch	= metal_x86_prefetch,
+};
+
+static const struct metal_io_copy_ops metal_x86_copy_avx2_ops = {
+	.name		= "avx2",
+	.copy		= metal_x86_copy_avx2,
+	.set		= metal_x86_set_avx2,
+	.stream_write	= metal_x86_stream_write_avx2,
+	.stream_read	= metal_x86_stream_read_avx2,
+	.copy_crc32c	= metal_x86_copy_crc32c_sse42,
+	.copy_swap	= metal_x86_copy_swap_ssse3,
+	.prefetch	= metal_x86_prefetch,
+};
+
+const struct metal_io_copy_ops *metal_processor_io_copy_ops(void)
+{
+	unsigned int eax, ebx, ecx, edx, line;
+
+	/* CLFLUSH line size, in units of 8 bytes. */
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		line = ((ebx >> 8) & 0xff) * 8;
+		if (line >= 16 && !(line & (line - 1)))
+			metal_x86_cache_line = line;
+	}
+
+	__builtin_cpu_init();
+	/*
+	 * Every AVX2 capable processor also implements SSE4.2, and every
+	 * SSE4.2 capable one SSSE3.
+	 */
+	if (__builtin_cpu_supports("avx2") &&
+	    __builtin_cpu_supports("sse4.2"))
+		return &metal_x86_copy_avx2_ops;
+	if (__builtin_cpu_supports("sse4.2"))
+		return &metal_x86_copy_sse42_ops;
+
+	/* SSE2 is part of the x86_64 baseline. */
+	return &metal_x86_copy_sse2_ops;
+}
@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2018, Xilinx Inc. and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * @file	regcache.c
+ * @brief	Software register cache for libmetal I/O regions.
+ */
+
+#include <errno.h>
+#include <metal/alloc.h>
+#include <metal/regcache.h>
+#include <metal/utilities.h>
+
+#define to_regcache(io)	metal_container_of(io, struct metal_regcache, io)
+
+/* Return the cacheable register accessed, or -1 to bypass the cache. */
+static long metal_regcache_reg(struct metal_regcache *cache,
+			       unsigned long offset, int width)
+{
+	unsigned long reg = offset / cache->width;
+
+	if (width != cache->width || offset % cache->width ||
+	    reg >= cache->nregs ||
+	    !metal_bitmap_is_bit_set(cache->cacheable, reg))
+		return -1;
+	return reg;
+}
+
+/*
+ * Write back the dirty registers overlapping a byte range, and optionally
+ * drop them from the cache.  Called with the cache lock held.
+ */
+static void metal_regcache_flush(struct metal_regcache *cache,
+				 unsigned long offset, size_t len, int drop)
+{
+	unsigned long reg, last;
+
+	if (!len || offset >= cache->nregs * cache->width)
+		return;
+	reg = offset / cache->width;
+	last = metal_min((offset + len - 1) / cache->width, cache->nregs - 1);
+	for (; reg <= last; reg++) {
+		if (metal_bitmap_is_bit_set(cache->dirty, reg)) {
+			metal_io_write(cache->backing, reg * cache->width,
+				       cache->values[reg],
+				       memory_order_seq_cst, cache->width);
+			metal_bitmap_clear_bit(cache->dirty, reg);
+		}
+		if (drop)
+			metal_bitmap_clear_bit(cache->valid, reg);
+	}
+}
+
+static uint64_t metal_regcache_read(struct metal_io_region *io,
+				    unsigned long offset,
+				    memory_order order,
+				    int width)
+{
+	struct metal_regcache *cache = to_regcache(io);
+	long reg = metal_regcache_reg(cache, offset, width);
+	uint64_t value;
+
+	metal_spinlock_acquire(&cache->lock);
+	if (reg < 0) {
+		metal_regcache_flush(cache, offset, width, 0);
+		value = metal_io_read(cache->backing, offset, order, width);
+	} else if (metal_bitmap_is_bit_set(cache->valid, reg)) {
+		cache->hits++;
+		value = cache->values[reg];
+	} else {
+		cache->misses++;
+		value = metal_io_read(cache->backing, offset, order, width);
+		cache->values[reg] = value;
+		metal_bitmap_set_bit(cache->valid, reg);
+	}
+	metal_spinlock_release(&cache->lock);
+	return value;
+}
+
+static void metal_regcache_write(struct metal_io_region *io,
+				 unsigned long offset,
+				 uint64_t value,
+				 memory_order order,
+				 int width)
+{
+	struct metal_regcache *cache = to_regcache(io);
+	long reg = metal_regcache_reg(cache, offset, width);
+
+	metal_spinlock_acquire(&cache->lock);
+	if (reg < 0) {
+		metal_regcache_flush(cache, offset, width, 1);
+		metal_io_write(cache->backing, offset, value, order, width);
+	} else {
+		cache->values[reg] = value;
+		metal_bitmap_set_bit(cache->valid, reg);
+		if (cache->mode == METAL_REGCACHE_WRITE_BACK)
+			metal_bitmap_set_bit(cache->dirty, reg);
+		else
+			metal_io_write(cache->backing, offset, value, order,
+				       width);
+	}
+	metal_spinlock_release(&cache->lock);
+}
+
+static int metal_regcache_block_read(struct metal_io_region *io,
+				     unsigned long offset,
+				     void *restrict dst,
+				     memory_order order,
+				     int len)
+{
+	struct metal_regcache *cache = to_regcache(io);
+
+	metal_spinlock_acquire(&cache->lock);
+	metal_regcache_flush(cache, offset, len, 0);
+	len = metal_io_block_read_explicit(cache->backing, offset, dst, len,
+					   order);
+	metal_spinlock_release(&cache->lock);
+	return len;
+}
+
+static int metal_regcache_block_write(struct metal_io_region *io,
+				      unsigned long offset,
+				      const void *restrict src,
+				      memory_order order,
+				      int len)
+{
+	struct metal_regcache *cache = to_regcache(io);
+
+	metal_spinlock_acquire(&cache->lock);
+	metal_regcache_flush(cache, offset, len, 1);
+	len = metal_io_block_write_explicit(cache->backing, offset, src, len,
+					    order);
+	metal_spinlock_release(&cache->lock);
+	return len;
+}
+
+static void metal_regcache_block_set(struct metal_io_region *io,
+				     unsigned long offset,
+				     unsigned char value,
+				     memory_order order,
+				     int len)
+{
+	struct metal_regcache *cache = to_regcache(io);
+
+	metal_spinlock_acquire(&cache->lock);
+	metal_regcache_flush(cache, offset, len, 1);
+	metal_io_block_set_explicit(cache->backing, offset, value, len, order);
+	metal_spinlock_release(&cache->lock);
+}
+
+static uint64_t metal_regcache_fetch_op(struct metal_io_region *io,
+					unsigned long offset,
+					enum metal_io_rmw_op op,
+					uint64_t value,
+					memory_order order,
+					int width)
+{
+	struct metal_regcache *cache = to_regcache(io);
+
+	metal_spinlock_acquire(&cache->lock);
+	metal_regcache_flush(cache, offset, width, 1);
+	value = metal_io_fetch_op(cache->backing, offset, op, value, order,
+				  width);
+	metal_spinlock_release(&cache->lock);
+	return value;
+}
+
+static int metal_regcache_cmpxchg(struct metal_io_region *io,
+				  unsigned long offset,
+				  uint64_t *expected,
+				  uint64_t desired,
+				  memory_order order,
+				  int width)
+{
+	struct metal_regcache *cache = to_regcache(io);
+	int ret;
+
+	metal_spinlock_acquire(&cache->lock);
+	metal_regcache_flush(cache, offset, width, 1);
+	ret = metal_io_cmpxchg(cache->backing, offset, expected, desired,
+			       order, width);
+	metal_spinlock_release(&cache->lock);
+	return ret;
+}
+
+static void metal_regcache_close(struct metal_io_region *io)
+{
+	struct metal_regcache *cache = to_regcache(io);
+
+	metal_regcache_sync(cache);
+	metal_free_memory(cache->values);
+	cache->values = NULL;
+
+	/* The extent table belongs to the backing region. */
+	io->num_extents = 0;
+}
+
+static const struct metal_io_ops metal_regcache_ops = {
+	.read		= metal_regcache_read,
+	.write		= metal_regcache_write,
+	.block_read	= metal_regcache_block_read,
+	.block_write	= metal_regcache_block_write,
+	.block_set	= metal_regcache_block_set,
+	.close		= metal_regcache_close,
+	.fetch_op	= metal_regcache_fetch_op,
+	.cmpxchg	= metal_regcache_cmpxchg,
+};
+
+int metal_regcache_init(struct metal_regcache *cache,
+			struct metal_io_region *backing, int width,
+			enum metal_regcache_mode mode)
+{
+	unsigned long nregs, longs;
+	size_t size;
+	void *mem;
+
+	if (width != 1 && width != 2 && width != 4 && width != 8)
+		return -EINVAL;
+
+	nregs = backing->size / width;
+	longs = metal_bitmap_longs(nregs);
+	size = nregs * sizeof(uint64_t) + 3 * longs * sizeof(unsigned long);
+	if (nregs > INT_MAX || size > UINT_MAX)
+		return -EINVAL;
+	mem = metal_allocate_memory(size);
+	if (!mem)
+		return -ENOMEM;
+	memset(mem, 0, size);
+
+	metal_io_init(&cache->io, backing->virt, NULL, backing->size, -1,
+		      backing->mem_flags, &metal_regcache_ops);
+	cache->io.physmap = backing->physmap;
+	cache->io.page_shift = backing->page_shift;
+	cache->io.page_mask = backing->page_mask;
+	cache->io.num_extents = backing->num_extents;
+	cache->io.extent = backing->extent;
+	cache->io.extents = backing->extents;
+	cache->io.base = backing->base;
+
+	cache->backing = backing;
+	cache->mode = mode;
+	cache->width = width;
+	cache->nregs = nregs;
+	cache->values = mem;
+	cache->cacheable = (unsigned long *)(cache->values + nregs);
+	cache->valid = cache->cacheable + longs;
+	cache->dirty = cache->valid + longs;
+	metal_spinlock_init(&cache->lock);
+	cache->hits = 0;
+	cache->misses = 0;
+	return 0;
+}
+
+void metal_regcache_finish(struct metal_regcache *cache)
+{
+	metal_io_finish(&cache->io);
+}
+
+int metal_regcache_set_cacheable(struct metal_regcache *cache,
+				 unsigned long offset, size_t len,
+				 int cacheable)
+{
+	unsigned long reg, last;
+
+	if (!len)
+		return 0;
+	if (offset >= cache->nregs * cache->width ||
+	    len > cache->nregs * cache->width - offset)
+		return -ERANGE;
+
+	reg = offset / cache->width;
+	last = (offset + len - 1) / cache->width;
+	metal_spinlock_acquire(&cache->lock);
+	if (!cacheable)
+		metal_regcache_flush(cache, offset, len, 1);
+	for (; reg <= last; reg++) {
+		if (cacheable)
+			metal_bitmap_set_bit(cache->cacheable, reg);
+		else
+			metal_bitmap_clear_bit(cache->cacheable, reg);
+	}
+	metal_spinlock_release(&cache->lock);
+	return 0;
+}
+
+void metal_regcache_sync(struct metal_regcache *cache)
+{
+	metal_spinlock_acquire(&cache->lock);
+	metal_regcache_flush(cache, 0, cache->nregs * cache->width, 0);
+	metal_spinlock_release(&cache->lock);
+}
+
+void metal_regcache_invalidate(struct metal_regcache *cache)
+{
+	size_t size = metal_bitmap_longs(cache->nregs) * sizeof(unsigned long);
+
+	metal_spinlock_acquire(&cache->lock);
+	memset(cache->valid, 0, size);
+	memset(cache->dirty, 0, size);
+	metal_spinlock_release(&cache->lock);
+}
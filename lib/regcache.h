@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2018, Xilinx Inc. and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * @file	regcache.h
+ * @brief	Software register cache for libmetal I/O regions.
+ */
+
+#ifndef __METAL_REGCACHE__H__
+#define __METAL_REGCACHE__H__
+
+#include <metal/io.h>
+#include <metal/spinlock.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \defgroup regcache Register Cache Interfaces
+ *  @{ */
+
+/** Register cache write policies. */
+enum metal_regcache_mode {
+	/** Writes update the cache and the device. */
+	METAL_REGCACHE_WRITE_THROUGH,
+	/** Writes update the cache until metal_regcache_sync(). */
+	METAL_REGCACHE_WRITE_BACK,
+};
+
+/**
+ * Register cache in front of an I/O region.
+ *
+ * The cache is itself an I/O region, whose ops serve reads of cacheable
+ * registers from memory, so it can be handed to any code that accesses
+ * registers through metal_io_read() and metal_io_write().  Registers are
+ * cached when accessed with the cache register width at an aligned offset;
+ * other accesses go to the device.  All registers start out volatile.
+ */
+struct metal_regcache {
+	struct metal_io_region	io;         /**< cached I/O region */
+	struct metal_io_region	*backing;   /**< underlying I/O region */
+	enum metal_regcache_mode mode;      /**< write policy */
+	int			width;      /**< register width in bytes */
+	unsigned long		nregs;      /**< number of registers */
+	uint64_t		*values;    /**< cached register values */
+	unsigned long		*cacheable; /**< bitmap of cacheable registers */
+	unsigned long		*valid;     /**< bitmap of cached registers */
+	unsigned long		*dirty;     /**< bitmap of registers to sync */
+	struct metal_spinlock	lock;       /**< protects the cache state */
+	unsigned long		hits;       /**< reads served from the cache */
+	unsigned long		misses;     /**< cacheable reads from device */
+};
+
+/**
+ * @brief	Attach a register cache to an I/O region.
+ *
+ * @param[out]	cache	Register cache to initialize.
+ * @param[in]	backing	I/O region to cache.
+ * @param[in]	width	Register width in bytes, 1, 2, 4 or 8.
+ * @param[in]	mode	Write policy.
+ * @return	0 on success, or -errno on failure.
+ */
+int metal_regcache_init(struct metal_regcache *cache,
+			struct metal_io_region *backing, int width,
+			enum metal_regcache_mode mode);
+
+/**
+ * @brief	Detach a register cache, writing back dirty registers.
+ * @param[in]	cache	Register cache.
+ */
+void metal_regcache_finish(struct metal_regcache *cache);
+
+/**
+ * @brief	Get the cached I/O region of a register cache.
+ * @param[in]	cache	Register cache.
+ * @return	I/O region handle.
+ */
+static inline struct metal_io_region *
+metal_regcache_io(struct metal_regcache *cache)
+{
+	return &cache->io;
+}
+
+/**
+ * @brief	Mark a range of registers cacheable or volatile.
+ *
+ * Making registers volatile writes back and drops their cached values.
+ *
+ * @param[in]	cache		Register cache.
+ * @param[in]	offset		Offset of the first register.
+ * @param[in]	len		Length in bytes of the range.
+ * @param[in]	cacheable	Non-zero for cacheable, zero for volatile.
+ * @return	0 on success, or -ERANGE if out of range.
+ */
+int metal_regcache_set_cacheable(struct metal_regcache *cache,
+				 unsigned long offset, size_t len,
+				 int cacheable);
+
+/**
+ * @brief	Write all dirty registers back to the device.
+ * @param[in]	cache	Register cache.
+ */
+void metal_regcache_sync(struct metal_regcache *cache);
+
+/**
+ * @brief	Drop cached register values, without writing them back.
+ *
+ * Used after the device has been reset behind the cache.
+ *
+ * @param[in]	cache	Register cache.
+ */
+void metal_regcache_invalidate(struct metal_regcache *cache);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __METAL_REGCACHE__H__ */
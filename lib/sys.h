@@ -53,6 +53,12 @@ struct metal_init_params {
 
 	/** default log message level (defaults to emergency). */
 	enum metal_log_level		log_level;
+
+	/**
+	 * NULL terminated names of the device buses to make available, or
+	 * NULL for all buses the system supports (Linux only).
+	 */
+	const char * const		*buses;
 };
 
 /**
@@ -13,13 +13,23 @@
 
 void metal_sys_io_mem_map(struct metal_io_region *io)
 {
+	const struct metal_io_extent *ext;
 	unsigned long p;
 	size_t psize;
 	void *va;
 
+	if (io->num_extents) {
+		ext = io->num_extents == 1 ? &io->extent : io->extents;
+		for (p = 0; p < io->num_extents; p++, ext++)
+			metal_machine_io_mem_map((uint8_t *)io->virt +
+						 ext->offset, ext->phys,
+						 ext->size, io->mem_flags);
+		return;
+	}
+
 	va = io->virt;
 	psize = io->size;
-	if (psize) {
+	if (psize && io->physmap) {
 		if (psize >> io->page_shift)
 			psize = (size_t)1 << io->page_shift;
 		for (p = 0; p <= (io->size >> io->page_shift); p++) {
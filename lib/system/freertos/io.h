@@ -16,7 +16,9 @@
 #ifndef __METAL_FREEROTS_IO__H__
 #define __METAL_FREEROTS_IO__H__
 
+#include <errno.h>
 #include <stdlib.h>
+#include <metal/utilities.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -35,6 +37,61 @@ void metal_sys_io_mem_map(struct metal_io_region *io);
 void *metal_machine_io_mem_map(void *va, metal_phys_addr_t pa,
 			       size_t size, unsigned int flags);
 
+/**
+ * @brief	Run a large block operation across threads.
+ *
+ * Not supported on this system; the caller does the work itself.
+ *
+ * @return	-ENOSYS.
+ */
+static inline int metal_sys_io_parallel(void *addr, size_t len,
+					unsigned int threads,
+					metal_io_chunk_fn fn, void *arg)
+{
+	metal_unused(addr);
+	metal_unused(len);
+	metal_unused(threads);
+	metal_unused(fn);
+	metal_unused(arg);
+	return -ENOSYS;
+}
+
+struct metal_io_async;
+
+/**
+ * @brief	Start software worker threads as an asynchronous backend.
+ *
+ * Not supported on this system, only device backends can be used.
+ *
+ * @return	-ENOSYS.
+ */
+static inline int metal_sys_io_async_start(struct metal_io_async *async,
+					   unsigned int threads)
+{
+	metal_unused(async);
+	metal_unused(threads);
+	return -ENOSYS;
+}
+
+/* No completion file descriptor on this system. */
+static inline int metal_sys_io_async_init(struct metal_io_async *async)
+{
+	metal_unused(async);
+	return 0;
+}
+
+static inline void metal_sys_io_async_finish(struct metal_io_async *async)
+{
+	metal_unused(async);
+}
+
+static inline void metal_sys_io_async_notify(struct metal_io_async *async,
+					     int ready)
+{
+	metal_unused(async);
+	metal_unused(ready);
+}
+
 #endif
 
 #ifdef __cplusplus
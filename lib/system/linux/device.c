@@ -9,12 +9,22 @@
  * @brief	Linux libmetal device operations.
  */
 
+#include <poll.h>
+#include <spawn.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
 #include <metal/device.h>
+#include <metal/mutex.h>
 #include <metal/sys.h>
+#include <metal/time.h>
 #include <metal/utilities.h>
 #include <metal/irq.h>
 
 #define MAX_DRIVERS	64
+#define UIO_DEV_TIMEOUT_MS	10	/**< wait for udev to create /dev/uioN */
+
+extern char **environ;
 
 struct linux_bus;
 struct linux_device;
@@ -25,7 +35,7 @@ struct linux_driver {
 	const char		*cls_name;
 	struct sysfs_driver	*sdrv;
 	int			(*dev_open)(struct linux_bus *lbus,
-					    struct linux_device *ldev);
+					    struct linux_device **ldev);
 	void			(*dev_close)(struct linux_bus *lbus,
 					     struct linux_device *ldev);
 	void			(*dev_irq_ack)(struct linux_bus *lbus,
@@ -49,20 +59,63 @@ struct linux_bus {
 	const char		*bus_name;
 	struct linux_driver	drivers[MAX_DRIVERS];
 	struct sysfs_bus	*sbus;
+	int			probed;
 };
 
 struct linux_device {
-	struct metal_device		device;
-	char				dev_name[PATH_MAX];
-	char				dev_path[PATH_MAX];
-	char				cls_path[PATH_MAX];
-	metal_phys_addr_t		region_phys[METAL_MAX_DEVICE_REGIONS];
+	char				*dev_name;
+	char				*dev_path;
+	char				*cls_path;
+	char				*sys_path;
+	metal_phys_addr_t		*region_phys;
 	struct linux_driver		*ldrv;
 	struct sysfs_device		*sdev;
 	struct sysfs_attribute		*override;
 	int				fd;
+	struct metal_device_ref		ref;	/* last, regions trail */
 };
 
+/*
+ * Size of a device with @n regions.  The region array of the embedded
+ * metal_device is kept last, so only the mapped regions are allocated,
+ * followed by their physical addresses.  Devices are therefore allocated
+ * truncated, and grown with realloc(): never copy one or take its sizeof.
+ */
+#define metal_linux_dev_size(n)						\
+	(offsetof(struct linux_device, ref.device.regions) +		\
+	 (n) * (sizeof(struct metal_io_region) + sizeof(metal_phys_addr_t)))
+
+_Static_assert(offsetof(struct metal_device, regions) +
+	       sizeof(((struct metal_device *)0)->regions) ==
+	       sizeof(struct metal_device),
+	       "metal_device regions must be last");
+_Static_assert(offsetof(struct linux_device, ref.device) +
+	       sizeof(struct metal_device) == sizeof(struct linux_device),
+	       "linux_device must end with its metal_device");
+
+/** Cached sysfs resolution of a device, indexed by driver and name. */
+struct linux_dev_index {
+	struct metal_list		node;
+	const void			*key;
+	char				*dev_name;
+	char				*sys_path;
+	char				*cls_path;
+	char				*dev_path;
+	unsigned			num_maps;
+	struct metal_linux_uio_map	maps[METAL_MAX_DEVICE_REGIONS];
+};
+
+/*
+ * Devices opened once are indexed so that reopening them skips sysfs.
+ * Entries are dropped on kernel uevents, other than "change", for the
+ * device or its parents or children, seen on a netlink socket drained at
+ * each lookup, and all of them on metal_linux_device_rescan().
+ */
+static METAL_MUTEX_DEFINE(metal_linux_index_lock);
+static METAL_DECLARE_LIST(metal_linux_index);
+static int metal_linux_uevent_fd = -1;
+static int metal_linux_index_off;
+
 static struct linux_bus *to_linux_bus(struct metal_bus *bus)
 {
 	return metal_container_of(bus, struct linux_bus, bus);
@@ -70,7 +123,25 @@ static struct linux_bus *to_linux_bus(struct metal_bus *bus)
 
 static struct linux_device *to_linux_device(struct metal_device *device)
 {
-	return metal_container_of(device, struct linux_device, device);
+	return metal_container_of(device, struct linux_device, ref.device);
+}
+
+/* Set a device path to a formatted string, allocated to fit. */
+static int metal_linux_dev_set_path(char **path, const char *fmt, ...)
+{
+	char buf[PATH_MAX];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (len >= (int)sizeof(buf))
+		return -EOVERFLOW;
+
+	free(*path);
+	*path = strdup(buf);
+	return *path ? 0 : -ENOMEM;
 }
 
 static int metal_uio_read_map_attr(struct linux_device *ldev, unsigned index,
@@ -92,6 +163,59 @@ static int metal_uio_read_map_attr(struct linux_device *ldev, unsigned index,
 	return 0;
 }
 
+/*
+ * Wait for a device node to be created, watching its directory with
+ * inotify instead of polling.  Returns 0 once the node exists.
+ */
+static int metal_linux_wait_for_node(const char *path, int timeout_ms)
+{
+	unsigned long long deadline, now;
+	char dir[PATH_MAX], *slash;
+	char events[sizeof(struct inotify_event) + NAME_MAX + 1];
+	struct pollfd pfd;
+	int fd, ret;
+
+	if (!access(path, F_OK))
+		return 0;
+
+	strncpy(dir, path, sizeof(dir) - 1);
+	dir[sizeof(dir) - 1] = '\0';
+	slash = strrchr(dir, '/');
+	if (!slash)
+		return -EINVAL;
+	*(slash == dir ? slash + 1 : slash) = '\0';
+
+	/* Without inotify, fall back to polling every millisecond. */
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd >= 0 &&
+	    inotify_add_watch(fd, dir, IN_CREATE | IN_MOVED_TO) < 0) {
+		close(fd);
+		fd = -1;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	deadline = metal_get_timestamp() + timeout_ms * 1000000ULL;
+	for (;;) {
+		/* Check after arming the watch, and after every event. */
+		ret = access(path, F_OK) ? -ENODEV : 0;
+		now = metal_get_timestamp();
+		if (!ret || now >= deadline)
+			break;
+		ret = poll(&pfd, 1, fd < 0 ? 1 :
+			   (int)((deadline - now + 999999) / 1000000));
+		if (ret < 0 && errno != EINTR) {
+			ret = -errno;
+			break;
+		}
+		while (fd >= 0 && read(fd, events, sizeof(events)) > 0)
+			;
+	}
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
 static int metal_uio_dev_bind(struct linux_device *ldev,
 			      struct linux_driver *ldrv)
 {
@@ -143,19 +267,265 @@ static int metal_uio_dev_bind(struct linux_device *ldev,
 	return 0;
 }
 
-static int metal_uio_dev_open(struct linux_bus *lbus, struct linux_device *ldev)
+/* Drop all index entries.  Called locked. */
+static void metal_linux_index_flush(void)
+{
+	struct metal_list *node;
+
+	while (!metal_list_is_empty(&metal_linux_index)) {
+		node = metal_list_first(&metal_linux_index);
+		metal_list_del(node);
+		free(metal_container_of(node, struct linux_dev_index, node));
+	}
+}
+
+/* Check if a sysfs device path is, or is within, another. */
+static int metal_linux_path_within(const char *path, const char *dir)
+{
+	size_t len = strlen(dir);
+
+	return !strncmp(path, dir, len) &&
+	       (path[len] == '\0' || path[len] == '/');
+}
+
+/* Check if a device is a uevent's device, its parent or its child. */
+static int metal_linux_uevent_affects(const char *sys_path,
+				      const char *devpath)
+{
+	const char *path = strstr(sys_path, "/devices/");
+
+	if (!path || !devpath)
+		return 1;
+	return metal_linux_path_within(path, devpath) ||
+	       metal_linux_path_within(devpath, path);
+}
+
+/* Drop the entries of devices affected by a uevent.  Called locked. */
+static void metal_linux_index_uevent_locked(const char *msg, size_t len)
+{
+	const char *end = msg + len, *devpath, *old = NULL, *key;
+	struct linux_dev_index *entry;
+	struct metal_list *node, *next;
+
+	/* "action@devpath", then NUL separated KEY=value pairs. */
+	devpath = memchr(msg, '@', len);
+	if (!devpath || !strncmp(msg, "change@", 7) ||
+	    !memchr(msg, '\0', len))
+		return;
+	devpath++;
+	for (key = msg + strlen(msg) + 1; key < end;
+	     key += strnlen(key, end - key) + 1)
+		if (!strncmp(key, "DEVPATH_OLD=", 12) &&
+		    memchr(key, '\0', end - key))
+			old = key + 12;
+
+	for (node = metal_linux_index.next; node != &metal_linux_index;
+	     node = next) {
+		next = node->next;
+		entry = metal_container_of(node, struct linux_dev_index, node);
+		if (metal_linux_uevent_affects(entry->sys_path, devpath) ||
+		    (old && metal_linux_uevent_affects(entry->sys_path, old))) {
+			metal_list_del(node);
+			free(entry);
+		}
+	}
+}
+
+void metal_linux_index_uevent(const char *msg, size_t len)
+{
+	metal_mutex_acquire(&metal_linux_index_lock);
+	metal_linux_index_uevent_locked(msg, len);
+	metal_mutex_release(&metal_linux_index_lock);
+}
+
+/*
+ * Start monitoring uevents, once.  Without them the index could not
+ * notice devices changing, so it is left disabled.  Called locked.
+ */
+static int metal_linux_index_open(void)
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	if (metal_linux_uevent_fd >= 0 || metal_linux_index_off)
+		return metal_linux_index_off ? -ENOTSUP : 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0) {
+		metal_log(METAL_LOG_DEBUG, "no uevents, device index off\n");
+		metal_linux_index_off = 1;
+		return -ENOTSUP;
+	}
+	metal_linux_uevent_fd = fd;
+	return 0;
+}
+
+/* Apply pending uevents to the index.  Called locked. */
+static int metal_linux_index_poll(void)
+{
+	char buf[8192];
+	ssize_t len;
+
+	if (metal_linux_index_open())
+		return -ENOTSUP;
+
+	while ((len = recv(metal_linux_uevent_fd, buf, sizeof(buf) - 1,
+			   0)) >= 0) {
+		buf[len] = '\0';
+		metal_linux_index_uevent_locked(buf, len);
+	}
+	/* Dropped events may have been anything. */
+	if (errno == ENOBUFS)
+		metal_linux_index_flush();
+	return 0;
+}
+
+int metal_linux_index_enabled(void)
+{
+	int ret;
+
+	metal_mutex_acquire(&metal_linux_index_lock);
+	ret = !metal_linux_index_open();
+	metal_mutex_release(&metal_linux_index_lock);
+	return ret;
+}
+
+static struct linux_dev_index *metal_linux_index_find(const void *key,
+						      const char *dev_name)
+{
+	struct linux_dev_index *entry;
+	struct metal_list *node;
+
+	metal_list_for_each(&metal_linux_index, node) {
+		entry = metal_container_of(node, struct linux_dev_index, node);
+		if (entry->key == key && !strcmp(entry->dev_name, dev_name))
+			return entry;
+	}
+	return NULL;
+}
+
+int metal_linux_index_get(const void *key, const char *dev_name,
+			  struct metal_linux_dev_info *info)
+{
+	struct linux_dev_index *entry = NULL;
+	int result = -ENOENT;
+
+	info->sys_path = info->cls_path = info->dev_path = NULL;
+	metal_mutex_acquire(&metal_linux_index_lock);
+	if (!metal_linux_index_poll())
+		entry = metal_linux_index_find(key, dev_name);
+	if (entry) {
+		info->sys_path = strdup(entry->sys_path);
+		info->cls_path = strdup(entry->cls_path);
+		info->dev_path = strdup(entry->dev_path);
+		info->num_maps = entry->num_maps;
+		memcpy(info->maps, entry->maps,
+		       entry->num_maps * sizeof(*info->maps));
+		result = 0;
+	}
+	metal_mutex_release(&metal_linux_index_lock);
+
+	if (!result && (!info->sys_path || !info->cls_path ||
+			!info->dev_path)) {
+		free(info->sys_path);
+		free(info->cls_path);
+		free(info->dev_path);
+		info->sys_path = info->cls_path = info->dev_path = NULL;
+		result = -ENOMEM;
+	}
+	return result;
+}
+
+static char *metal_linux_index_copy(char **p, const char *str)
+{
+	char *copy = *p;
+
+	*p = stpcpy(copy, str) + 1;
+	return copy;
+}
+
+void metal_linux_index_put(const void *key, const char *dev_name,
+			   const struct metal_linux_dev_info *info)
+{
+	struct linux_dev_index *entry, *old;
+	char *p;
+
+	if (info->num_maps > METAL_MAX_DEVICE_REGIONS)
+		return;
+
+	/* The strings follow the entry, in one allocation. */
+	entry = malloc(sizeof(*entry) + strlen(dev_name) +
+		       strlen(info->sys_path) + strlen(info->cls_path) +
+		       strlen(info->dev_path) + 4);
+	if (!entry)
+		return;
+	p = (char *)(entry + 1);
+	entry->dev_name = metal_linux_index_copy(&p, dev_name);
+	entry->sys_path = metal_linux_index_copy(&p, info->sys_path);
+	entry->cls_path = metal_linux_index_copy(&p, info->cls_path);
+	entry->dev_path = metal_linux_index_copy(&p, info->dev_path);
+	entry->key = key;
+	entry->num_maps = info->num_maps;
+	memcpy(entry->maps, info->maps, info->num_maps * sizeof(*info->maps));
+
+	/*
+	 * Take in pending uevents first, so that those of the device being
+	 * bound on this open do not immediately drop its new entry.
+	 */
+	metal_mutex_acquire(&metal_linux_index_lock);
+	if (metal_linux_index_poll()) {
+		metal_mutex_release(&metal_linux_index_lock);
+		free(entry);
+		return;
+	}
+	old = metal_linux_index_find(key, dev_name);
+	if (old) {
+		metal_list_del(&old->node);
+		free(old);
+	}
+	metal_list_add_tail(&metal_linux_index, &entry->node);
+	metal_mutex_release(&metal_linux_index_lock);
+}
+
+void metal_linux_index_drop(const void *key, const char *dev_name)
+{
+	struct linux_dev_index *entry;
+
+	metal_mutex_acquire(&metal_linux_index_lock);
+	entry = metal_linux_index_find(key, dev_name);
+	if (entry) {
+		metal_list_del(&entry->node);
+		free(entry);
+	}
+	metal_mutex_release(&metal_linux_index_lock);
+}
+
+void metal_linux_device_rescan(void)
+{
+	metal_mutex_acquire(&metal_linux_index_lock);
+	metal_linux_index_flush();
+	metal_mutex_release(&metal_linux_index_lock);
+}
+
+/* Resolve the uio instance and map table of a device through sysfs. */
+static int metal_uio_dev_resolve(struct linux_bus *lbus,
+				 struct linux_device *ldev,
+				 struct metal_linux_uio_map *maps,
+				 unsigned *num_maps)
 {
 	char *instance, path[SYSFS_PATH_MAX];
 	struct linux_driver *ldrv = ldev->ldrv;
-	unsigned long *phys, offset=0, size=0;
-	struct metal_io_region *io;
 	struct dlist *dlist;
-	int result, i;
-	void *virt;
-	int irq_info;
-
-
-	ldev->fd = -1;
+	unsigned i;
+	int result;
 
 	ldev->sdev = sysfs_open_device(lbus->bus_name, ldev->dev_name);
 	if (!ldev->sdev) {
@@ -170,6 +540,10 @@ static int metal_uio_dev_open(struct linux_bus *lbus, struct linux_device *ldev)
 	if (result)
 		return result;
 
+	result = metal_linux_dev_set_path(&ldev->sys_path, "%s",
+					  ldev->sdev->path);
+	if (result)
+		return result;
 	result = snprintf(path, sizeof(path), "%s/uio", ldev->sdev->path);
 	if (result >= (int)sizeof(path))
 		return -EOVERFLOW;
@@ -181,34 +555,55 @@ static int metal_uio_dev_open(struct linux_bus *lbus, struct linux_device *ldev)
 	}
 
 	dlist_for_each_data(dlist, instance, char) {
-		result = snprintf(ldev->cls_path, sizeof(ldev->cls_path),
-				  "%s/%s", path, instance);
-		if (result >= (int)sizeof(ldev->cls_path))
-			return -EOVERFLOW;
-		result = snprintf(ldev->dev_path, sizeof(ldev->dev_path),
-				  "/dev/%s", instance);
-		if (result >= (int)sizeof(ldev->dev_path))
-			return -EOVERFLOW;
+		result = metal_linux_dev_set_path(&ldev->cls_path, "%s/%s",
+						  path, instance);
+		result = (result ? result :
+			  metal_linux_dev_set_path(&ldev->dev_path, "/dev/%s",
+						   instance));
 		break;
 	}
 	sysfs_close_list(dlist);
+	if (result)
+		return result;
 
-	if (sysfs_path_is_dir(ldev->cls_path) != 0) {
+	if (!ldev->cls_path || sysfs_path_is_dir(ldev->cls_path) != 0) {
 		metal_log(METAL_LOG_ERROR, "invalid device class path %s\n",
 			  ldev->cls_path);
 		return -ENODEV;
 	}
 
-	i = 0;
-	do {
-		if (!access(ldev->dev_path, F_OK))
+	for (i = 0; i < METAL_MAX_DEVICE_REGIONS; i++) {
+		if (metal_uio_read_map_attr(ldev, i, "offset",
+					    &maps[i].offset) ||
+		    metal_uio_read_map_attr(ldev, i, "addr", &maps[i].addr) ||
+		    metal_uio_read_map_attr(ldev, i, "size", &maps[i].size))
 			break;
-		usleep(10);
-		i++;
-	} while (i < 1000);
-	if (i >= 1000) {
-		metal_log(METAL_LOG_ERROR, "failed to open file %s, timeout.\n",
-			  ldev->dev_path);
+	}
+	*num_maps = i;
+	return 0;
+}
+
+/* Open the uio device node and map its regions. */
+static int metal_uio_dev_map(struct linux_bus *lbus,
+			     struct linux_device **ldevp,
+			     const struct metal_linux_uio_map *maps,
+			     unsigned num_maps, int timeout_ms)
+{
+	struct linux_device *ldev = *ldevp;
+	struct metal_io_region *io;
+	metal_phys_addr_t *phys;
+	unsigned i;
+	int result;
+	void *virt;
+	int irq_info;
+
+	result = metal_linux_wait_for_node(ldev->dev_path, timeout_ms);
+	if (result) {
+		/* A stale index entry is not an error. */
+		if (timeout_ms)
+			metal_log(METAL_LOG_ERROR, "failed to open file %s, %s.\n",
+				  ldev->dev_path, result == -ENODEV ?
+				  "timeout" : strerror(-result));
 		return -ENODEV;
 	}
 	result = metal_open(ldev->dev_path, 0);
@@ -222,21 +617,28 @@ static int metal_uio_dev_open(struct linux_bus *lbus, struct linux_device *ldev)
 	metal_log(METAL_LOG_DEBUG, "opened %s:%s as %s\n",
 		  lbus->bus_name, ldev->dev_name, ldev->dev_path);
 
-	for (i = 0, result = 0; !result && i < METAL_MAX_DEVICE_REGIONS; i++) {
-		phys = &ldev->region_phys[ldev->device.num_regions];
-		result = (result ? result :
-			 metal_uio_read_map_attr(ldev, i, "offset", &offset));
-		result = (result ? result :
-			 metal_uio_read_map_attr(ldev, i, "addr", phys));
-		result = (result ? result :
-			 metal_uio_read_map_attr(ldev, i, "size", &size));
-		result = (result ? result :
-			 metal_map(ldev->fd, offset, size, 0, 0, &virt));
-		if (!result) {
-			io = &ldev->device.regions[ldev->device.num_regions];
-			metal_io_init(io, virt, phys, size, -1, 0, NULL);
-			ldev->device.num_regions++;
+	/* Grow the device to its regions and their physical addresses. */
+	if (num_maps) {
+		ldev = realloc(ldev, metal_linux_dev_size(num_maps));
+		if (!ldev) {
+			close((*ldevp)->fd);
+			(*ldevp)->fd = -1;
+			return -ENOMEM;
 		}
+		*ldevp = ldev;
+		ldev->region_phys = (metal_phys_addr_t *)
+				    &ldev->ref.device.regions[num_maps];
+	}
+
+	for (i = 0; i < num_maps; i++) {
+		if (metal_map(ldev->fd, maps[i].offset, maps[i].size, 0, 0,
+			      &virt))
+			break;
+		phys = &ldev->region_phys[i];
+		*phys = maps[i].addr;
+		io = &ldev->ref.device.regions[i];
+		metal_io_init(io, virt, phys, maps[i].size, -1, 0, NULL);
+		ldev->ref.device.num_regions++;
 	}
 
 	irq_info = 1;
@@ -244,22 +646,86 @@ static int metal_uio_dev_open(struct linux_bus *lbus, struct linux_device *ldev)
 		metal_log(METAL_LOG_INFO,
 			  "%s: No IRQ for device %s.\n",
 			  __func__, ldev->dev_name);
-		ldev->device.irq_num =  0;
-		ldev->device.irq_info = (void *)-1;
+		ldev->ref.device.irq_num =  0;
+		ldev->ref.device.irq_info = (void *)-1;
 	} else {
-		ldev->device.irq_num =  1;
-		ldev->device.irq_info = (void *)(intptr_t)ldev->fd;
+		ldev->ref.device.irq_num =  1;
+		ldev->ref.device.irq_info = (void *)(intptr_t)ldev->fd;
 	}
+	return 0;
+}
+
+static int metal_uio_dev_open(struct linux_bus *lbus,
+			      struct linux_device **ldevp)
+{
+	struct linux_device *ldev = *ldevp;
+	struct metal_linux_uio_map maps[METAL_MAX_DEVICE_REGIONS];
+	unsigned long long start = metal_get_timestamp();
+	struct metal_linux_dev_info info;
+	int result;
 
+	ldev->fd = -1;
+
+	/*
+	 * An indexed device was bound and resolved when last opened.  Its
+	 * class path disappears if it has since been unbound, and the index
+	 * entry is dropped if the node cannot be opened, so stale entries
+	 * fall back to sysfs.
+	 */
+	info.maps = maps;
+	if (!metal_linux_index_get(ldev->ldrv, ldev->dev_name, &info)) {
+		ldev->sys_path = info.sys_path;
+		ldev->cls_path = info.cls_path;
+		ldev->dev_path = info.dev_path;
+		if (!access(ldev->cls_path, F_OK) &&
+		    !metal_uio_dev_map(lbus, ldevp, maps, info.num_maps, 0))
+			goto out;
+		metal_linux_index_drop(ldev->ldrv, ldev->dev_name);
+	}
+
+	result = metal_uio_dev_resolve(lbus, ldev, maps, &info.num_maps);
+	if (!result)
+		result = metal_uio_dev_map(lbus, ldevp, maps, info.num_maps,
+					   UIO_DEV_TIMEOUT_MS);
+	if (result)
+		return result;
+	ldev = *ldevp;
+	info.sys_path = ldev->sys_path;
+	info.cls_path = ldev->cls_path;
+	info.dev_path = ldev->dev_path;
+	metal_linux_index_put(ldev->ldrv, ldev->dev_name, &info);
+
+out:
+	metal_log(METAL_LOG_DEBUG, "opened %s:%s in %llu us\n",
+		  lbus->bus_name, ldev->dev_name,
+		  (metal_get_timestamp() - start) / 1000);
 	return 0;
 }
 
+void metal_linux_dev_unmap(struct metal_device *device)
+{
+	struct metal_io_region *io;
+	size_t size;
+	unsigned i;
+	void *virt;
+
+	for (i = 0; i < device->num_regions; i++) {
+		io = &device->regions[i];
+		/* metal_io_finish() clears the region. */
+		virt = io->virt;
+		size = io->size;
+		metal_io_finish(io);
+		metal_unmap(virt, size);
+	}
+	device->num_regions = 0;
+}
+
 static void metal_uio_dev_close(struct linux_bus *lbus,
 				struct linux_device *ldev)
 {
 	(void)lbus;
 
-	if ((intptr_t)ldev->device.irq_info >= 0)
+	if ((intptr_t)ldev->ref.device.irq_info >= 0)
 		/* Normally this call would not be needed, and is added as precaution.
 		   Also for uio there is only 1 interrupt associated to the fd/device,
 		   we therefore do not need to specify a particular device */
@@ -276,6 +742,13 @@ static void metal_uio_dev_close(struct linux_bus *lbus,
 	if (ldev->fd >= 0) {
 		close(ldev->fd);
 	}
+
+	metal_linux_dev_unmap(&ldev->ref.device);
+	ldev->region_phys = NULL;
+	free(ldev->sys_path);
+	free(ldev->cls_path);
+	free(ldev->dev_path);
+	ldev->sys_path = ldev->cls_path = ldev->dev_path = NULL;
 }
 
 static void metal_uio_dev_irq_ack(struct linux_bus *lbus,
@@ -319,8 +792,8 @@ static int metal_uio_dev_dma_map(struct linux_bus *lbus,
 	for (i = 0; i < nents_in; i++) {
 		vaddr_sg_lo = sg_in[i].virt;
 		vaddr_sg_hi = vaddr_sg_lo + sg_in[i].len;
-		for (j = 0, io = ldev->device.regions;
-		     j < (int)ldev->device.num_regions; j++, io++) {
+		for (j = 0, io = ldev->ref.device.regions;
+		     j < (int)ldev->ref.device.num_regions; j++, io++) {
 			vaddr_lo = io->virt;
 			vaddr_hi = vaddr_lo + io->size;
 			if (vaddr_sg_lo >= vaddr_lo &&
@@ -328,7 +801,7 @@ static int metal_uio_dev_dma_map(struct linux_bus *lbus,
 				break;
 			}
 		}
-		if (j == (int)ldev->device.num_regions) {
+		if (j == (int)ldev->ref.device.num_regions) {
 			metal_log(METAL_LOG_WARNING,
 			  "%s,%s: input address isn't MMIO addr: 0x%x,%d.\n",
 			__func__, ldev->dev_name, vaddr_sg_lo, sg_in[i].len);
@@ -412,19 +885,38 @@ static struct linux_bus linux_bus[] = {
 #define for_each_linux_driver(lbus, ldrv)			\
 	for ((ldrv) = lbus->drivers; (ldrv)->drv_name; (ldrv)++)
 
+/*
+ * Serializes the deferred probing of buses on first device open, and the
+ * lookup and reference counting of open devices.
+ */
+static METAL_MUTEX_DEFINE(metal_linux_bus_lock);
+
+static int metal_linux_probe_bus(struct linux_bus *lbus);
 
 static int metal_linux_dev_open(struct metal_bus *bus,
 				const char *dev_name,
 				struct metal_device **device)
 {
 	struct linux_bus *lbus = to_linux_bus(bus);
-	struct linux_device *ldev = NULL;
+	struct linux_device *ldev;
 	struct linux_driver *ldrv;
+	char *name;
 	int error;
 
-	ldev = malloc(sizeof(*ldev));
-	if (!ldev)
-		return -ENOMEM;
+	metal_mutex_acquire(&metal_linux_bus_lock);
+	error = lbus->probed ? 0 : metal_linux_probe_bus(lbus);
+	if (error)
+		goto out;
+
+	/* Share the device if it is already open. */
+	*device = metal_device_ref_get(bus, dev_name);
+	if (*device)
+		goto out;
+
+	name = strdup(dev_name);
+	error = -ENOMEM;
+	if (!name)
+		goto out;
 
 	for_each_linux_driver(lbus, ldrv) {
 
@@ -432,37 +924,36 @@ static int metal_linux_dev_open(struct metal_bus *bus,
 		if (!ldrv->sdrv || !ldrv->dev_open)
 			continue;
 
-		/* Allocate a linux device if we haven't already. */
-		if (!ldev)
-			ldev = malloc(sizeof(*ldev));
+		/* Start with no regions, the driver grows the device. */
+		ldev = calloc(1, metal_linux_dev_size(0));
+		error = -ENOMEM;
 		if (!ldev)
-			return -ENOMEM;
-
-		/* Reset device data. */
-		memset(ldev, 0, sizeof(*ldev));
-		strncpy(ldev->dev_name, dev_name, sizeof(ldev->dev_name) - 1);
+			goto out_free;
+		ldev->dev_name = name;
 		ldev->fd = -1;
 		ldev->ldrv = ldrv;
-		ldev->device.bus = bus;
+		ldev->ref.device.bus = bus;
 
 		/* Try and open the device. */
-		error = ldrv->dev_open(lbus, ldev);
+		error = ldrv->dev_open(lbus, &ldev);
 		if (error) {
 			ldrv->dev_close(lbus, ldev);
+			free(ldev);
 			continue;
 		}
 
-		*device = &ldev->device;
-		(*device)->name = ldev->dev_name;
-
-		metal_list_add_tail(&bus->devices, &(*device)->node);
-		return 0;
+		ldev->ref.device.name = ldev->dev_name;
+		metal_device_ref_add(bus, &ldev->ref);
+		*device = &ldev->ref.device;
+		goto out;
 	}
 
-	if (ldev)
-		free(ldev);
-
-	return -ENODEV;
+	error = -ENODEV;
+out_free:
+	free(name);
+out:
+	metal_mutex_release(&metal_linux_bus_lock);
+	return error;
 }
 
 static void metal_linux_dev_close(struct metal_bus *bus,
@@ -471,9 +962,14 @@ static void metal_linux_dev_close(struct metal_bus *bus,
 	struct linux_device *ldev = to_linux_device(device);
 	struct linux_bus *lbus = to_linux_bus(bus);
 
-	ldev->ldrv->dev_close(lbus, ldev);
-	metal_list_del(&device->node);
-	free(ldev);
+	/* The last reference closes the device. */
+	metal_mutex_acquire(&metal_linux_bus_lock);
+	if (!metal_device_ref_put(device)) {
+		ldev->ldrv->dev_close(lbus, ldev);
+		free(ldev->dev_name);
+		free(ldev);
+	}
+	metal_mutex_release(&metal_linux_bus_lock);
 }
 
 static void metal_linux_bus_close(struct metal_bus *bus)
@@ -487,8 +983,10 @@ static void metal_linux_bus_close(struct metal_bus *bus)
 		ldrv->sdrv = NULL;
 	}
 
-	sysfs_close_bus(lbus->sbus);
+	if (lbus->sbus)
+		sysfs_close_bus(lbus->sbus);
 	lbus->sbus = NULL;
+	lbus->probed = 0;
 }
 
 static void metal_linux_dev_irq_ack(struct metal_bus *bus,
@@ -544,48 +1042,59 @@ static int metal_linux_register_bus(struct linux_bus *lbus)
 	return metal_bus_register(&lbus->bus);
 }
 
+/*
+ * Run modprobe, directly rather than through a shell, with its output
+ * discarded.  Returns 0 if it succeeded.
+ */
+static int metal_linux_modprobe(const char *mod_name, int sudo)
+{
+	char *argv[] = {
+		"sudo", "-n", "modprobe", "-q", (char *)mod_name, NULL,
+	};
+	char **args = sudo ? argv : argv + 2;
+	posix_spawn_file_actions_t actions;
+	int ret, status;
+	pid_t pid;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+					 O_WRONLY, 0);
+	posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO,
+					 STDERR_FILENO);
+	ret = posix_spawnp(&pid, args[0], &actions, NULL, args, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (ret) {
+		metal_log(METAL_LOG_DEBUG, "%s: failed to run %s - %s\n",
+			  __func__, args[0], strerror(ret));
+		return -ret;
+	}
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			return -errno;
+	}
+	return WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -ENODEV;
+}
+
 static int metal_linux_probe_driver(struct linux_bus *lbus,
 				    struct linux_driver *ldrv)
 {
-	char command[256];
-	int ret;
-
 	ldrv->sdrv = sysfs_open_driver(lbus->bus_name, ldrv->drv_name);
 
 	/* Try probing the module and then open the driver. */
-	if (!ldrv->sdrv) {
-		ret = snprintf(command, sizeof(command),
-			       "modprobe %s > /dev/null 2>&1", ldrv->mod_name);
-		if (ret >= (int)sizeof(command))
-			return -EOVERFLOW;
-		ret = system(command);
-		if (ret < 0) {
-			metal_log(METAL_LOG_WARNING,
-				  "%s: executing system command '%s' failed.\n",
-				  __func__, command);
-		}
+	if (!ldrv->sdrv && !metal_linux_modprobe(ldrv->mod_name, 0))
 		ldrv->sdrv = sysfs_open_driver(lbus->bus_name, ldrv->drv_name);
-	}
 
-	/* Try sudo probing the module and then open the driver. */
-	if (!ldrv->sdrv) {
-		ret = snprintf(command, sizeof(command),
-			       "sudo modprobe %s > /dev/null 2>&1", ldrv->mod_name);
-		if (ret >= (int)sizeof(command))
-			return -EOVERFLOW;
-		ret = system(command);
-		if (ret < 0) {
-			metal_log(METAL_LOG_WARNING,
-				  "%s: executing system command '%s' failed.\n",
-				  __func__, command);
-		}
+	/* Try sudo probing the module, without prompting for a password. */
+	if (!ldrv->sdrv && geteuid() != 0 &&
+	    !metal_linux_modprobe(ldrv->mod_name, 1))
 		ldrv->sdrv = sysfs_open_driver(lbus->bus_name, ldrv->drv_name);
-	}
 
 	/* If all else fails... */
 	return ldrv->sdrv ? 0 : -ENODEV;
 }
 
+/* Open a bus and its driver, on the first device open.  Called locked. */
 static int metal_linux_probe_bus(struct linux_bus *lbus)
 {
 	struct linux_driver *ldrv;
@@ -607,26 +1116,43 @@ static int metal_linux_probe_bus(struct linux_bus *lbus)
 		return error;
 	}
 
-	error = metal_linux_register_bus(lbus);
-	if (error) {
-		sysfs_close_driver(ldrv->sdrv);
-		ldrv->sdrv = NULL;
-		sysfs_close_bus(lbus->sbus);
-		lbus->sbus = NULL;
-	}
+	metal_log(METAL_LOG_DEBUG, "probed %s bus with driver %s\n",
+		  lbus->bus_name, ldrv->drv_name);
+	lbus->probed = 1;
+	return 0;
+}
 
-	return error;
+static int metal_linux_bus_wanted(struct linux_bus *lbus,
+				  const char * const *buses)
+{
+	if (!buses)
+		return 1;
+	for (; *buses; buses++)
+		if (!strcmp(*buses, lbus->bus_name))
+			return 1;
+	return 0;
 }
 
-int metal_linux_bus_init(void)
+int metal_linux_bus_init(const char * const *buses)
 {
 	struct linux_bus *lbus;
-	int valid = 0;
+	int error;
 
-	for_each_linux_bus(lbus)
-		valid += metal_linux_probe_bus(lbus) ? 0 : 1;
+	/*
+	 * Buses are only registered here.  Opening sysfs and loading driver
+	 * modules is deferred to the first device open on each bus, so
+	 * applications pay only for the buses they use.
+	 */
+	for_each_linux_bus(lbus) {
+		if (!metal_linux_bus_wanted(lbus, buses))
+			continue;
+		lbus->probed = 0;
+		error = metal_linux_register_bus(lbus);
+		if (error)
+			return error;
+	}
 
-	return valid ? 0 : -ENODEV;
+	return 0;
 }
 
 void metal_linux_bus_finish(void)
@@ -638,6 +1164,14 @@ void metal_linux_bus_finish(void)
 		if (metal_bus_find(lbus->bus_name, &bus) == 0)
 			metal_bus_unregister(bus);
 	}
+
+	metal_mutex_acquire(&metal_linux_index_lock);
+	metal_linux_index_flush();
+	if (metal_linux_uevent_fd >= 0)
+		close(metal_linux_uevent_fd);
+	metal_linux_uevent_fd = -1;
+	metal_linux_index_off = 0;
+	metal_mutex_release(&metal_linux_index_lock);
 }
 
 int metal_generic_dev_sys_open(struct metal_device *dev)
@@ -657,8 +1191,10 @@ int metal_linux_get_device_property(struct metal_device *device,
 	struct linux_device *ldev = to_linux_device(device);
 	char path[PATH_MAX];
 
-	snprintf(path, sizeof(path), "%s/of_node/%s",
-			 ldev->sdev->path, property_name);
+	status = snprintf(path, sizeof(path), "%s/of_node/%s",
+			  ldev->sys_path, property_name);
+	if (status >= (int)sizeof(path))
+		return -EOVERFLOW;
 	fd = open(path, flags, mode);
 	if (fd < 0)
 		return -errno;
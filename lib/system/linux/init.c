@@ -145,7 +145,7 @@ int metal_sys_init(const struct metal_init_params *params)
 	if (result < 0)
 		return result;
 
-	result = metal_linux_bus_init();
+	result = metal_linux_bus_init(params->buses);
 	if (result < 0)
 		return result;
 
@@ -156,8 +156,6 @@ int metal_sys_init(const struct metal_init_params *params)
 	}
 	_metal.pagemap_fd = result;
 
-	metal_unused(params);
-
 	/* Initialize IRQ handling */
 	metal_linux_irq_init();
 	return 0;
@@ -168,6 +166,7 @@ void metal_sys_finish(void)
 
 	/* Shutdown IRQ handling */
 	metal_linux_irq_shutdown();
+	metal_linux_io_finish();
 	metal_linux_bus_finish();
 	close(_metal.pagemap_fd);
 
@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2018, Xilinx Inc. and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * @file	linux/io.c
+ * @brief	Linux worker threads for large libmetal block operations.
+ */
+
+#define _GNU_SOURCE	/* CPU affinity */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <metal/alloc.h>
+#include <metal/atomic.h>
+#include <metal/io.h>
+#include <metal/io_async.h>
+#include <metal/sys.h>
+#include <metal/utilities.h>
+
+#define METAL_IO_MAX_WORKERS	64	/**< worker threads in the pool */
+#define METAL_IO_CHUNKS		4	/**< chunks per thread, for balance */
+
+#define METAL_MPOL_F_NODE	(1 << 0)
+#define METAL_MPOL_F_ADDR	(1 << 1)
+
+/** Software asynchronous backend. */
+struct metal_linux_io_async {
+	pthread_mutex_t		lock;      /**< protects the fields below */
+	pthread_cond_t		cond;      /**< signals queued jobs or stop */
+	struct metal_list	queue;     /**< jobs waiting for a worker */
+	int			stop;      /**< workers exit once idle */
+	unsigned int		nthreads;  /**< workers started */
+	pthread_t		threads[]; /**< worker threads */
+};
+
+/** Worker pool shared by all parallel block operations. */
+struct metal_io_pool {
+	pthread_mutex_t	submit;     /**< serializes operations */
+	pthread_mutex_t	lock;       /**< protects the fields below */
+	pthread_cond_t	work;       /**< signals a new generation */
+	pthread_cond_t	done;       /**< signals pending reaching zero */
+	pthread_t	threads[METAL_IO_MAX_WORKERS];
+	unsigned int	nthreads;   /**< workers started */
+	int		node;       /**< NUMA node workers run on, or -1 */
+	unsigned long	generation; /**< bumped for each operation */
+	unsigned long	base;       /**< generation new workers start at */
+	int		stop;       /**< workers should exit */
+
+	/* Current operation. */
+	metal_io_chunk_fn fn;
+	void		*arg;
+	size_t		len;
+	size_t		chunk;
+	atomic_ulong	next;       /**< next chunk to claim */
+	unsigned int	workers;    /**< workers taking part */
+	unsigned int	pending;    /**< workers not done yet */
+};
+
+static struct metal_io_pool metal_io_pool = {
+	.submit	= PTHREAD_MUTEX_INITIALIZER,
+	.lock	= PTHREAD_MUTEX_INITIALIZER,
+	.work	= PTHREAD_COND_INITIALIZER,
+	.done	= PTHREAD_COND_INITIALIZER,
+	.node	= -1,
+};
+
+static void metal_io_pool_run(struct metal_io_pool *pool)
+{
+	size_t offset;
+	unsigned long i;
+
+	for (;;) {
+		i = atomic_fetch_add(&pool->next, 1);
+		offset = i * pool->chunk;
+		if (offset >= pool->len)
+			break;
+		pool->fn(pool->arg, offset,
+			 metal_min(pool->chunk, pool->len - offset));
+	}
+}
+
+static void *metal_io_pool_worker(void *arg)
+{
+	struct metal_io_pool *pool = &metal_io_pool;
+	unsigned int index = (uintptr_t)arg;
+	unsigned long seen;
+
+	pthread_mutex_lock(&pool->lock);
+	seen = pool->base;
+	for (;;) {
+		while (!pool->stop && pool->generation == seen)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->stop)
+			break;
+		seen = pool->generation;
+		if (index >= pool->workers)
+			continue;
+
+		pthread_mutex_unlock(&pool->lock);
+		metal_io_pool_run(pool);
+		pthread_mutex_lock(&pool->lock);
+
+		if (!--pool->pending)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/* NUMA node holding the page at addr, or -1 if not known. */
+static int metal_io_node_of(void *addr)
+{
+	int node = -1;
+
+#ifdef SYS_get_mempolicy
+	if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr,
+		    METAL_MPOL_F_NODE | METAL_MPOL_F_ADDR) < 0)
+		node = -1;
+#else
+	metal_unused(addr);
+#endif
+	return node;
+}
+
+/* Read the CPUs of a NUMA node from its sysfs cpulist, e.g. "0-3,8-11". */
+static int metal_io_node_cpus(int node, cpu_set_t *cpus)
+{
+	char path[PATH_MAX], list[1024], *p, *end;
+	unsigned long first, last;
+	FILE *file;
+
+	snprintf(path, sizeof(path), "%s/devices/system/node/node%d/cpulist",
+		 _metal.sysfs_path ? _metal.sysfs_path : "/sys", node);
+	file = fopen(path, "r");
+	if (!file)
+		return -errno;
+	p = fgets(list, sizeof(list), file);
+	fclose(file);
+	if (!p)
+		return -EINVAL;
+
+	CPU_ZERO(cpus);
+	while (*p && *p != '\n') {
+		first = strtoul(p, &end, 10);
+		if (end == p)
+			return -EINVAL;
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (end == p)
+				return -EINVAL;
+		}
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, cpus);
+		p = *end == ',' ? end + 1 : end;
+	}
+	return CPU_COUNT(cpus) ? 0 : -EINVAL;
+}
+
+/* Move the workers to the node of addr, so they fill local memory. */
+static void metal_io_pool_place(struct metal_io_pool *pool, void *addr)
+{
+	int node = metal_io_node_of(addr);
+	unsigned int i;
+	cpu_set_t cpus;
+
+	if (node < 0 || node == pool->node ||
+	    metal_io_node_cpus(node, &cpus))
+		return;
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_setaffinity_np(pool->threads[i], sizeof(cpus), &cpus);
+	pool->node = node;
+}
+
+/* Start workers up to count, returning how many are available. */
+static unsigned int metal_io_pool_grow(struct metal_io_pool *pool,
+				       unsigned int count)
+{
+	unsigned int started = pool->nthreads;
+	cpu_set_t cpus;
+	int ret;
+
+	/*
+	 * A worker may first get the lock after the operation that started
+	 * it has been posted, which it must still take part in.
+	 */
+	pthread_mutex_lock(&pool->lock);
+	pool->base = pool->generation;
+	pthread_mutex_unlock(&pool->lock);
+	count = metal_min(count, (unsigned int)METAL_IO_MAX_WORKERS);
+	while (pool->nthreads < count) {
+		ret = pthread_create(&pool->threads[pool->nthreads], NULL,
+				     metal_io_pool_worker,
+				     (void *)(uintptr_t)pool->nthreads);
+		if (ret) {
+			metal_log(METAL_LOG_DEBUG,
+				  "%s: failed to start worker - %s\n",
+				  __func__, strerror(ret));
+			break;
+		}
+		pool->nthreads++;
+	}
+
+	/* New workers join the node the pool is already placed on. */
+	if (pool->node >= 0 && started < pool->nthreads &&
+	    !metal_io_node_cpus(pool->node, &cpus)) {
+		for (; started < pool->nthreads; started++)
+			pthread_setaffinity_np(pool->threads[started],
+					       sizeof(cpus), &cpus);
+	}
+	return pool->nthreads;
+}
+
+int metal_sys_io_parallel(void *addr, size_t len, unsigned int threads,
+			  metal_io_chunk_fn fn, void *arg)
+{
+	struct metal_io_pool *pool = &metal_io_pool;
+	size_t page = _metal.page_size ? _metal.page_size : 4096;
+	unsigned int workers;
+	size_t chunk;
+
+	if (threads < 2)
+		return -EINVAL;
+
+	pthread_mutex_lock(&pool->submit);
+	workers = metal_io_pool_grow(pool, threads - 1);
+	if (!workers) {
+		pthread_mutex_unlock(&pool->submit);
+		return -EAGAIN;
+	}
+	workers = metal_min(workers, threads - 1);
+	metal_io_pool_place(pool, addr);
+
+	/* Page sized chunks, so no two threads write the same page. */
+	chunk = len / ((workers + 1) * METAL_IO_CHUNKS);
+	chunk = metal_align_up(metal_max(chunk, page), page);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->len = len;
+	pool->chunk = chunk;
+	atomic_store(&pool->next, 0);
+	pool->workers = workers;
+	pool->pending = workers;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	metal_io_pool_run(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	pthread_mutex_unlock(&pool->submit);
+	return 0;
+}
+
+void metal_linux_io_finish(void)
+{
+	struct metal_io_pool *pool = &metal_io_pool;
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->submit);
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pool->nthreads = 0;
+	pool->node = -1;
+	pool->stop = 0;
+	pthread_mutex_unlock(&pool->submit);
+}
+
+static void *metal_io_async_worker(void *arg)
+{
+	struct metal_io_async *async = arg;
+	struct metal_linux_io_async *sw = async->priv;
+	struct metal_io_async_job *job;
+
+	pthread_mutex_lock(&sw->lock);
+	for (;;) {
+		while (!sw->stop && metal_list_is_empty(&sw->queue))
+			pthread_cond_wait(&sw->cond, &sw->lock);
+		if (metal_list_is_empty(&sw->queue))
+			break;
+		job = metal_container_of(metal_list_first(&sw->queue),
+					 struct metal_io_async_job, node);
+		metal_list_del(&job->node);
+		pthread_mutex_unlock(&sw->lock);
+
+		if (job->type == METAL_IO_ASYNC_COPY)
+			job->result = metal_io_block_copy(job->dst_io,
+							  job->dst_off,
+							  job->src_io,
+							  job->src_off,
+							  job->len);
+		else
+			job->result = metal_io_block_set(job->dst_io,
+							 job->dst_off,
+							 job->value,
+							 job->len);
+		metal_io_async_complete(async, job);
+
+		pthread_mutex_lock(&sw->lock);
+	}
+	pthread_mutex_unlock(&sw->lock);
+	return NULL;
+}
+
+static int metal_io_async_sw_submit(struct metal_io_async *async,
+				    struct metal_io_async_job *job)
+{
+	struct metal_linux_io_async *sw = async->priv;
+
+	pthread_mutex_lock(&sw->lock);
+	metal_list_add_tail(&sw->queue, &job->node);
+	pthread_cond_signal(&sw->cond);
+	pthread_mutex_unlock(&sw->lock);
+	return 0;
+}
+
+/* Let the workers drain the queue, then release them. */
+static void metal_io_async_sw_close(struct metal_io_async *async)
+{
+	struct metal_linux_io_async *sw = async->priv;
+	unsigned int i;
+
+	pthread_mutex_lock(&sw->lock);
+	sw->stop = 1;
+	pthread_cond_broadcast(&sw->cond);
+	pthread_mutex_unlock(&sw->lock);
+
+	for (i = 0; i < sw->nthreads; i++)
+		pthread_join(sw->threads[i], NULL);
+
+	pthread_cond_destroy(&sw->cond);
+	pthread_mutex_destroy(&sw->lock);
+	metal_free_memory(sw);
+	async->priv = NULL;
+}
+
+int metal_sys_io_async_start(struct metal_io_async *async,
+			     unsigned int threads)
+{
+	struct metal_linux_io_async *sw;
+	int ret;
+
+	if (!threads)
+		threads = 1;
+	sw = metal_allocate_memory(sizeof(*sw) + threads * sizeof(pthread_t));
+	if (!sw)
+		return -ENOMEM;
+	pthread_mutex_init(&sw->lock, NULL);
+	pthread_cond_init(&sw->cond, NULL);
+	metal_list_init(&sw->queue);
+	sw->stop = 0;
+	sw->nthreads = 0;
+
+	async->priv = sw;
+	async->ops.submit = metal_io_async_sw_submit;
+	async->ops.close = metal_io_async_sw_close;
+
+	for (; sw->nthreads < threads; sw->nthreads++) {
+		ret = pthread_create(&sw->threads[sw->nthreads], NULL,
+				     metal_io_async_worker, async);
+		if (ret) {
+			metal_log(METAL_LOG_DEBUG,
+				  "%s: failed to start worker - %s\n",
+				  __func__, strerror(ret));
+			break;
+		}
+	}
+	if (!sw->nthreads) {
+		metal_io_async_sw_close(async);
+		async->ops.submit = NULL;
+		async->ops.close = NULL;
+		return -ret;
+	}
+	return 0;
+}
+
+int metal_sys_io_async_init(struct metal_io_async *async)
+{
+	async->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (async->fd < 0)
+		return -errno;
+	return 0;
+}
+
+void metal_sys_io_async_finish(struct metal_io_async *async)
+{
+	if (async->fd >= 0)
+		close(async->fd);
+	async->fd = -1;
+}
+
+void metal_sys_io_async_notify(struct metal_io_async *async, int ready)
+{
+	uint64_t val = 1;
+	ssize_t ret;
+
+	if (async->fd < 0)
+		return;
+	if (ready)
+		ret = write(async->fd, &val, sizeof(val));
+	else
+		ret = read(async->fd, &val, sizeof(val));
+	if (ret < 0 && errno != EAGAIN)
+		metal_log(METAL_LOG_ERROR, "%s: eventfd %d failed - %s\n",
+			  __func__, async->fd, strerror(errno));
+}
@@ -26,6 +26,59 @@ extern "C" {
 
 #define metal_sys_io_mem_map(...)
 
+/**
+ * @brief	Run a large block operation across threads.
+ *
+ * Splits [0, len) into chunks handed to fn by the calling thread and up to
+ * threads - 1 pooled worker threads, which are kept on the NUMA node of
+ * addr where that is known.
+ *
+ * @param[in]	addr	Start of the memory operated on.
+ * @param[in]	len	Length in bytes of the operation.
+ * @param[in]	threads	Maximum number of threads to use.
+ * @param[in]	fn	Function called for each chunk.
+ * @param[in]	arg	Argument passed to fn.
+ * @return	0 once all chunks are done, or -errno if no worker could be
+ *		started, in which case nothing was done.
+ */
+int metal_sys_io_parallel(void *addr, size_t len, unsigned int threads,
+			  metal_io_chunk_fn fn, void *arg);
+
+struct metal_io_async;
+
+/**
+ * @brief	Start software worker threads as an asynchronous backend.
+ *
+ * @param[in]	async	Engine with no device backend.
+ * @param[in]	threads	Number of worker threads.
+ * @return	0 on success, or -errno on failure.
+ */
+int metal_sys_io_async_start(struct metal_io_async *async,
+			     unsigned int threads);
+
+/**
+ * @brief	Open the completion eventfd of an asynchronous engine.
+ * @param[in]	async	Engine being initialized.
+ * @return	0 on success, or -errno on failure.
+ */
+int metal_sys_io_async_init(struct metal_io_async *async);
+
+/**
+ * @brief	Close the completion eventfd of an engine.
+ * @param[in]	async	Engine.
+ */
+void metal_sys_io_async_finish(struct metal_io_async *async);
+
+/**
+ * @brief	Signal or clear pending completions of an engine.
+ *
+ * Called with the engine lock held.
+ *
+ * @param[in]	async	Engine.
+ * @param[in]	ready	Non-zero if completed jobs are queued.
+ */
+void metal_sys_io_async_notify(struct metal_io_async *async, int ready);
+
 #endif
 
 #ifdef __cplusplus
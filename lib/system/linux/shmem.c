@@ -21,25 +21,61 @@ struct metal_shmem {
 static void metal_shmem_io_close(struct metal_io_region *io)
 {
 	metal_unmap(io->virt, io->size);
-	free((void *)io->physmap);
 }
 
 static const struct metal_io_ops metal_shmem_io_ops = {
-	NULL, NULL, NULL, NULL, NULL, metal_shmem_io_close
+	.close	= metal_shmem_io_close,
 };
 
+/*
+ * Record the physical address of one page, extending the last extent
+ * when the page is physically contiguous with it.
+ */
+static int metal_shmem_add_page(struct metal_io_extent **extents,
+				unsigned int *num, unsigned int *max,
+				unsigned long offset, size_t size,
+				metal_phys_addr_t phys)
+{
+	struct metal_io_extent *ext = *extents;
+
+	if (*num) {
+		struct metal_io_extent *last = &ext[*num - 1];
+
+		if (last->offset + last->size == offset &&
+		    last->phys + last->size == phys) {
+			last->size += size;
+			return 0;
+		}
+	}
+
+	if (*num == *max) {
+		*max = *max ? *max * 2 : 8;
+		ext = realloc(ext, *max * sizeof(*ext));
+		if (!ext)
+			return -ENOMEM;
+		*extents = ext;
+	}
+
+	ext[*num].offset = offset;
+	ext[*num].size = size;
+	ext[*num].phys = phys;
+	(*num)++;
+	return 0;
+}
+
 static int metal_shmem_try_map(struct metal_page_size *ps, int fd, size_t size,
 			       struct metal_io_region **result)
 {
-	size_t pages, page, phys_size;
+	struct metal_io_extent *extents = NULL;
+	unsigned int num = 0, max = 0;
 	struct metal_io_region *io;
-	metal_phys_addr_t *phys;
+	metal_phys_addr_t phys;
+	size_t offset;
 	uint8_t *virt;
 	void *mem;
 	int error;
 
 	size = metal_align_up(size, ps->page_size);
-	pages = size / ps->page_size;
 
 	error = metal_map(fd, 0, size, 1, ps->mmap_flags, &mem);
 	if (error) {
@@ -54,34 +90,43 @@ static int metal_shmem_try_map(struct metal_page_size *ps, int fd, size_t size,
 			  strerror(-error));
 	}
 
-	phys_size = sizeof(*phys) * pages;
-	phys = malloc(phys_size);
-	if (!phys) {
-		metal_unmap(mem, size);
-		return -ENOMEM;
-	}
-
 	io = malloc(sizeof(*io));
 	if (!io) {
-		free(phys);
 		metal_unmap(mem, size);
 		return -ENOMEM;
 	}
 
-	if (_metal.pagemap_fd < 0) {
-		phys[0] = 0;
+	error = -ENOSYS;
+	if (_metal.pagemap_fd >= 0) {
+		error = 0;
+		for (virt = mem, offset = 0; offset < size && !error;
+		     offset += ps->page_size) {
+			if (metal_virt2phys(virt + offset, &phys) < 0)
+				continue;
+			/* Without CAP_SYS_ADMIN, pagemap hides PFNs as 0. */
+			if (!phys) {
+				error = -EPERM;
+				break;
+			}
+			error = metal_shmem_add_page(&extents, &num, &max,
+						     offset, ps->page_size,
+						     phys);
+		}
+	}
+	if (error == -ENOSYS || error == -EPERM) {
 		metal_log(METAL_LOG_WARNING,
 		"shmem - failed to get va2pa mapping. use offset as pa.\n");
-		metal_io_init(io, mem, phys, size, -1, 0, &metal_shmem_io_ops);
-	} else {
-		for (virt = mem, page = 0; page < pages; page++) {
-			size_t offset = page * ps->page_size;
-			error = metal_virt2phys(virt + offset, &phys[page]);
-			if (error < 0)
-				phys[page] = METAL_BAD_OFFSET;
-		}
-		metal_io_init(io, mem, phys, size, ps->page_shift, 0,
-			&metal_shmem_io_ops);
+		num = 0;
+		error = metal_shmem_add_page(&extents, &num, &max, 0, size, 0);
+	}
+	if (!error)
+		error = metal_io_init_extents(io, mem, extents, num, size, 0,
+					      &metal_shmem_io_ops);
+	free(extents);
+	if (error) {
+		free(io);
+		metal_unmap(mem, size);
+		return error;
 	}
 	*result = io;
 
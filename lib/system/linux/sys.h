@@ -94,9 +94,93 @@ struct metal_state {
 	int			pagemap_fd;
 };
 
+/**
+ * @brief	Forget cached device lookups.
+ *
+ * Devices opened once are remembered, so that reopening them does not walk
+ * sysfs again.  The cache is dropped on kernel device events, where these
+ * can be monitored; call this after changing devices or their bindings by
+ * other means.
+ */
+extern void metal_linux_device_rescan(void);
+
 #ifdef METAL_INTERNAL
-extern int metal_linux_bus_init(void);
+
+/** uio map attributes of a device. */
+struct metal_linux_uio_map {
+	unsigned long		offset;     /**< offset into the uio node */
+	unsigned long		addr;       /**< physical address */
+	unsigned long		size;       /**< size in bytes */
+};
+
+/** Resolved sysfs location and uio maps of a device. */
+struct metal_linux_dev_info {
+	char			*sys_path;  /**< sysfs device path */
+	char			*cls_path;  /**< uio class path */
+	char			*dev_path;  /**< uio device node */
+	unsigned		num_maps;   /**< number of maps */
+	struct metal_linux_uio_map *maps;   /**< METAL_MAX_DEVICE_REGIONS
+						 maps */
+};
+
+/**
+ * @brief	Look up a device in the index of opened devices.
+ *
+ * @param[in]	key		Driver the device was opened with.
+ * @param[in]	dev_name	Device name.
+ * @param[in,out] info		Device information, filled in with paths
+ *				that the caller must free, and maps copied
+ *				to info->maps.
+ * @return	0 if found, -ENOENT if not or if the index is disabled, or
+ *		-ENOMEM.
+ */
+extern int metal_linux_index_get(const void *key, const char *dev_name,
+				 struct metal_linux_dev_info *info);
+
+/**
+ * @brief	Add or replace a device in the index of opened devices.
+ *
+ * @param[in]	key		Driver the device was opened with.
+ * @param[in]	dev_name	Device name.
+ * @param[in]	info		Device information, copied.
+ */
+extern void metal_linux_index_put(const void *key, const char *dev_name,
+				  const struct metal_linux_dev_info *info);
+
+/**
+ * @brief	Remove a device from the index of opened devices.
+ * @param[in]	key		Driver the device was opened with.
+ * @param[in]	dev_name	Device name.
+ */
+extern void metal_linux_index_drop(const void *key, const char *dev_name);
+
+/**
+ * @brief	Apply a kernel uevent to the index of opened devices.
+ *
+ * Entries of the uevent's device, and of its parents and children, are
+ * dropped, unless the uevent is a "change".
+ *
+ * @param[in]	msg		uevent message, "action@devpath" followed by
+ *				NUL separated KEY=value pairs.
+ * @param[in]	len		Message length.
+ */
+extern void metal_linux_index_uevent(const char *msg, size_t len);
+
+/**
+ * @brief	Check if the index of opened devices is in use.
+ * @return	1 if kernel uevents can be monitored, 0 if not.
+ */
+extern int metal_linux_index_enabled(void);
+
+/**
+ * @brief	Close and unmap the I/O regions of a device.
+ * @param[in]	device	Device whose regions were mapped with metal_map().
+ */
+extern void metal_linux_dev_unmap(struct metal_device *device);
+
+extern int metal_linux_bus_init(const char * const *buses);
 extern void metal_linux_bus_finish(void);
+extern void metal_linux_io_finish(void);
 
 extern int metal_open(const char *path, int shm);
 extern int metal_open_unlinked(const char *path, int shm);
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2018, Xilinx Inc. and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* The device index and shared handle helpers are internal. */
+#define METAL_INTERNAL
+
+#include "metal-test.h"
+#include <metal/device.h>
+#include <metal/log.h>
+#include <metal/sys.h>
+#include <metal/utilities.h>
+
+#define DEV_NAME	"ff340000.ipi"
+#define DEV_PATH	"/devices/platform/amba/" DEV_NAME
+
+static const int index_key, index_other_key;
+
+static char index_sys_path[] = "/sys" DEV_PATH;
+static char index_cls_path[] = "/sys" DEV_PATH "/uio/uio3";
+static char index_dev_path[] = "/dev/uio3";
+
+static struct metal_linux_uio_map index_maps[] = {
+	{ .offset = 0x0,    .addr = 0xff340000, .size = 0x1000 },
+	{ .offset = 0x1000, .addr = 0x3ed00000, .size = 0x40000 },
+};
+
+static const struct metal_linux_dev_info index_info = {
+	.sys_path	= index_sys_path,
+	.cls_path	= index_cls_path,
+	.dev_path	= index_dev_path,
+	.num_maps	= metal_dim(index_maps),
+	.maps		= index_maps,
+};
+
+/* Check if the device is indexed, with what it was put with. */
+static int index_has(const void *key)
+{
+	struct metal_linux_uio_map maps[METAL_MAX_DEVICE_REGIONS];
+	struct metal_linux_dev_info info = { .maps = maps };
+	int found;
+
+	if (metal_linux_index_get(key, DEV_NAME, &info))
+		return 0;
+	found = !strcmp(info.sys_path, index_sys_path) &&
+		!strcmp(info.cls_path, index_cls_path) &&
+		!strcmp(info.dev_path, index_dev_path) &&
+		info.num_maps == metal_dim(index_maps) &&
+		!memcmp(maps, index_maps, sizeof(index_maps));
+	free(info.sys_path);
+	free(info.cls_path);
+	free(info.dev_path);
+	return found ? 1 : -1;
+}
+
+/* Put the device in the index, then send it a uevent. */
+static int index_uevent(const char *msg, size_t len)
+{
+	metal_linux_index_put(&index_key, DEV_NAME, &index_info);
+	if (index_has(&index_key) != 1)
+		return -1;
+	metal_linux_index_uevent(msg, len);
+	return index_has(&index_key);
+}
+
+#define UEVENT(s)	s, sizeof(s)
+
+static int device_index(void)
+{
+	metal_linux_device_rescan();
+	if (!metal_linux_index_enabled()) {
+		/* Without uevents, nothing is cached. */
+		metal_log(METAL_LOG_INFO, "no uevents, index disabled\n");
+		metal_linux_index_put(&index_key, DEV_NAME, &index_info);
+		return index_has(&index_key) ? -EINVAL : 0;
+	}
+
+	/* Lookups are by driver and name. */
+	metal_linux_index_put(&index_key, DEV_NAME, &index_info);
+	if (index_has(&index_key) != 1 || index_has(&index_other_key))
+		return -EINVAL;
+	metal_linux_index_drop(&index_key, DEV_NAME);
+	if (index_has(&index_key))
+		return -EINVAL;
+
+	/* Other devices and attribute changes leave the entry alone. */
+	if (index_uevent(UEVENT("change@" DEV_PATH "\0ACTION=change\0"
+				"DEVPATH=" DEV_PATH "\0SUBSYSTEM=platform")) != 1 ||
+	    index_uevent(UEVENT("add@/devices/pci0000:00/0000:00:14.0/usb1\0"
+				"ACTION=add\0SUBSYSTEM=usb")) != 1 ||
+	    index_uevent(UEVENT("bind@" DEV_PATH "0\0ACTION=bind\0"
+				"SUBSYSTEM=platform")) != 1)
+		return -EINVAL;
+
+	/* The device, its children and its parents drop it. */
+	if (index_uevent(UEVENT("unbind@" DEV_PATH "\0ACTION=unbind\0"
+				"SUBSYSTEM=platform")) ||
+	    index_uevent(UEVENT("remove@" DEV_PATH "/uio/uio3\0"
+				"ACTION=remove\0SUBSYSTEM=uio")) ||
+	    index_uevent(UEVENT("remove@/devices/platform/amba\0"
+				"ACTION=remove\0SUBSYSTEM=platform")) ||
+	    index_uevent(UEVENT("move@/devices/platform/axi/" DEV_NAME "\0"
+				"ACTION=move\0DEVPATH_OLD=" DEV_PATH "\0")))
+		return -EINVAL;
+
+	/* Rescans drop everything. */
+	metal_linux_index_put(&index_key, DEV_NAME, &index_info);
+	metal_linux_device_rescan();
+	return index_has(&index_key) ? -EINVAL : 0;
+}
+METAL_ADD_TEST(device_index);
+
+static int device_refs(void)
+{
+	struct metal_device_ref refs[2] = {
+		{ .device = { .name = "ipi" } },
+		{ .device = { .name = "shm" } },
+	};
+	struct metal_bus bus = { .name = "refs" };
+
+	metal_list_init(&bus.devices);
+	if (metal_device_ref_get(&bus, "ipi"))
+		return -EINVAL;
+	metal_device_ref_add(&bus, &refs[0]);
+	metal_device_ref_add(&bus, &refs[1]);
+
+	/* Opening an open device shares its handle. */
+	if (metal_device_ref_get(&bus, "ipi") != &refs[0].device ||
+	    metal_device_ref_get(&bus, "ipi") != &refs[0].device ||
+	    metal_device_ref_get(&bus, "shm") != &refs[1].device ||
+	    refs[0].refs != 3 || refs[1].refs != 2 ||
+	    refs[0].device.bus != &bus)
+		return -EINVAL;
+
+	/* Only the last close takes it off the bus. */
+	if (metal_device_ref_put(&refs[0].device) != 2 ||
+	    metal_device_ref_put(&refs[0].device) != 1 ||
+	    metal_device_ref_get(&bus, "ipi") != &refs[0].device ||
+	    metal_device_ref_put(&refs[0].device) != 1 ||
+	    metal_device_ref_put(&refs[0].device) != 0 ||
+	    metal_device_ref_get(&bus, "ipi"))
+		return -EINVAL;
+	if (metal_device_ref_put(&refs[1].device) != 1 ||
+	    metal_device_ref_put(&refs[1].device) != 0 ||
+	    !metal_list_is_empty(&bus.devices))
+		return -EINVAL;
+	return 0;
+}
+METAL_ADD_TEST(device_refs);
+
+static int device_unmap(void)
+{
+	static struct metal_device device = { .name = "unmap" };
+	size_t size = 2 * getpagesize();
+	unsigned char vec[2];
+	void *virt[2];
+	unsigned i;
+
+	for (i = 0; i < metal_dim(virt); i++) {
+		if (metal_map(-1, 0, size, 0, 0, &virt[i]))
+			return -ENOMEM;
+		metal_io_init(&device.regions[i], virt[i], NULL, size, -1, 0,
+			      NULL);
+		device.num_regions++;
+	}
+
+	/* The last close leaves nothing mapped. */
+	metal_linux_dev_unmap(&device);
+	if (device.num_regions)
+		return -EINVAL;
+	for (i = 0; i < metal_dim(virt); i++)
+		if (mincore(virt[i], size, vec) != -1 || errno != ENOMEM)
+			return -EINVAL;
+	return 0;
+}
+METAL_ADD_TEST(device_unmap);
+
+static int device_buses(void)
+{
+	static const char * const buses[] = { "platform", NULL };
+	struct metal_bus *bus;
+	int error = 0;
+
+	/* Only the requested buses are registered. */
+	metal_linux_bus_finish();
+	if (metal_linux_bus_init(buses) ||
+	    metal_bus_find("platform", &bus) ||
+	    strcmp(bus->name, "platform") ||
+	    !metal_bus_find("pci", &bus))
+		error = -EINVAL;
+
+	/* Restore all buses for the other tests. */
+	metal_linux_bus_finish();
+	if (metal_linux_bus_init(NULL) ||
+	    metal_bus_find("platform", &bus) ||
+	    metal_bus_find("pci", &bus))
+		error = -EINVAL;
+	return error;
+}
+METAL_ADD_TEST(device_buses);
@@ -0,0 +1,1076 @@
+/*
+ * Copyright (c) 2018, Xilinx Inc. and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metal-test.h"
+#include <metal/dma.h>
+#include <metal/io.h>
+#include <metal/log.h>
+#include <metal/sleep.h>
+#include <metal/sys.h>
+#include <metal/utilities.h>
+
+#define IO_TEST_SIZE	1024
+#define IO_TEST_ALIGN	32
+
+static uint8_t io_mem[IO_TEST_SIZE] metal_align(64);
+static uint8_t io_buf[IO_TEST_SIZE] metal_align(64);
+static uint8_t io_ref[IO_TEST_SIZE];
+
+static void io_pattern(uint8_t *buf, size_t len, uint8_t seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (uint8_t)(seed + i * 7);
+}
+
+static int io_block(void)
+{
+	const int lens[] = { 0, 1, 2, 3, 7, 8, 15, 16, 17, 31, 32, 33, 63,
+			     64, 65, 127, 128, 129, 255, 300, 513 };
+	struct metal_io_region io;
+	unsigned int i, soff, doff;
+	int len, ret;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+
+	for (i = 0; i < metal_dim(lens); i++) {
+		len = lens[i];
+		for (soff = 0; soff < IO_TEST_ALIGN; soff++) {
+			for (doff = 0; doff < IO_TEST_ALIGN; doff++) {
+				/* Write from an unaligned buffer. */
+				memset(io_mem, 0xa5, sizeof(io_mem));
+				io_pattern(io_buf, sizeof(io_buf), len + soff);
+				memcpy(io_ref, io_mem, sizeof(io_ref));
+				memcpy(io_ref + doff, io_buf + soff, len);
+				ret = metal_io_block_write(&io, doff,
+							   io_buf + soff, len);
+				if (ret != len ||
+				    memcmp(io_mem, io_ref, sizeof(io_ref))) {
+					metal_log(METAL_LOG_ERROR,
+						  "block write %d @%u<-%u\n",
+						  len, doff, soff);
+					return -EINVAL;
+				}
+
+				/* Read back into an unaligned buffer. */
+				memset(io_buf, 0x5a, sizeof(io_buf));
+				memcpy(io_ref, io_buf, sizeof(io_ref));
+				memcpy(io_ref + soff, io_mem + doff, len);
+				ret = metal_io_block_read(&io, doff,
+							  io_buf + soff, len);
+				if (ret != len ||
+				    memcmp(io_buf, io_ref, sizeof(io_ref))) {
+					metal_log(METAL_LOG_ERROR,
+						  "block read %d @%u->%u\n",
+						  len, doff, soff);
+					return -EINVAL;
+				}
+			}
+
+			/* Fill at each destination alignment. */
+			memset(io_mem, 0xa5, sizeof(io_mem));
+			memcpy(io_ref, io_mem, sizeof(io_ref));
+			memset(io_ref + soff, (uint8_t)len, len);
+			ret = metal_io_block_set(&io, soff, (uint8_t)len, len);
+			if (ret != len ||
+			    memcmp(io_mem, io_ref, sizeof(io_ref))) {
+				metal_log(METAL_LOG_ERROR,
+					  "block set %d @%u\n", len, soff);
+				return -EINVAL;
+			}
+		}
+	}
+
+	/* Transfers are clipped to the end of the region. */
+	ret = metal_io_block_read(&io, sizeof(io_mem) - 4, io_buf, 16);
+	if (ret != 4)
+		return -EINVAL;
+	ret = metal_io_block_write(&io, sizeof(io_mem) + 1, io_buf, 16);
+	if (ret != -ERANGE)
+		return -EINVAL;
+
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_block);
+
+static int io_stream(void)
+{
+	const int len = METAL_IO_STREAM_THRESHOLD + 1000 + 3;
+	const size_t size = METAL_IO_STREAM_THRESHOLD * 2;
+	struct metal_io_region io;
+	uint8_t *mem, *src, *dst;
+	int i, ret, error = -ENOMEM;
+
+	mem = malloc(size);
+	src = malloc(size);
+	dst = malloc(size);
+	if (!mem || !src || !dst)
+		goto out;
+
+	error = -EINVAL;
+	metal_io_init(&io, mem, NULL, size, -1, 0, NULL);
+	if (metal_io_enable_stream(&io) || metal_io_enable_stream(&io) ||
+	    io.ops.block_read || io.ops.block_write || !io.direct)
+		goto out;
+
+	io_pattern(src, size, 0x33);
+	memset(mem, 0, size);
+	for (i = 0; i < 2; i++) {
+		/* Streamed and cached sized transfers at odd alignments. */
+		int n = i ? len : 4099;
+
+		ret = metal_io_block_write(&io, 3, src + 1, n);
+		if (ret != n || memcmp(mem + 3, src + 1, n) ||
+		    mem[2] || mem[3 + n])
+			goto out;
+		memset(dst, 0, size);
+		ret = metal_io_block_read(&io, 3, dst + 5, n);
+		if (ret != n || memcmp(dst + 5, src + 1, n) ||
+		    dst[4] || dst[5 + n])
+			goto out;
+	}
+	metal_io_finish(&io);
+	error = 0;
+out:
+	free(dst);
+	free(src);
+	free(mem);
+	return error;
+}
+METAL_ADD_TEST(io_stream);
+
+static int io_block_explicit(void)
+{
+	struct metal_io_region io;
+	uint8_t out[48];
+	int ret;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	io_pattern(io_buf, sizeof(io_buf), 0x11);
+	memset(io_mem, 0, sizeof(io_mem));
+
+	/* Batch of relaxed writes published by a release write. */
+	ret = metal_io_block_write_explicit(&io, 0, io_buf, 16,
+					    memory_order_relaxed);
+	ret += metal_io_block_write_explicit(&io, 16, io_buf + 16, 16,
+					     memory_order_relaxed);
+	ret += metal_io_block_set_explicit(&io, 32, 0xee, 8,
+					   memory_order_relaxed);
+	ret += metal_io_block_write_explicit(&io, 40, io_buf + 40, 8,
+					     memory_order_release);
+	if (ret != 48)
+		return -EINVAL;
+
+	ret = metal_io_block_read_explicit(&io, 0, out, sizeof(out),
+					   memory_order_acquire);
+	if (ret != (int)sizeof(out) || memcmp(out, io_buf, 32) ||
+	    out[32] != 0xee || out[39] != 0xee ||
+	    memcmp(out + 40, io_buf + 40, 8))
+		return -EINVAL;
+
+	if (metal_io_block_read_explicit(&io, sizeof(io_mem) + 1, out, 1,
+					 memory_order_relaxed) != -ERANGE)
+		return -EINVAL;
+
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_block_explicit);
+
+/* Block ops that move at most 100 bytes per call, backed by io_buf. */
+static int io_short_block_read(struct metal_io_region *io,
+			       unsigned long offset, void *restrict dst,
+			       memory_order order, int len)
+{
+	(void)io;
+	(void)order;
+	len = metal_min(len, 100);
+	memcpy(dst, io_buf + offset, len);
+	return len;
+}
+
+static int io_short_block_write(struct metal_io_region *io,
+				unsigned long offset, const void *restrict src,
+				memory_order order, int len)
+{
+	(void)io;
+	(void)order;
+	len = metal_min(len, 100);
+	memcpy(io_buf + offset, src, len);
+	return len;
+}
+
+static const struct metal_io_ops io_short_ops = {
+	.block_read	= io_short_block_read,
+	.block_write	= io_short_block_write,
+};
+
+static int io_block_vector(void)
+{
+	uint8_t hdr[5], payload[301], trailer[3];
+	struct metal_sg sg[3] = {
+		{ .virt = hdr,		.len = sizeof(hdr) },
+		{ .virt = payload,	.len = sizeof(payload) },
+		{ .virt = trailer,	.len = sizeof(trailer) },
+	};
+	const int total = sizeof(hdr) + sizeof(payload) + sizeof(trailer);
+	struct metal_io_region io;
+	int ret;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	io_pattern(hdr, sizeof(hdr), 1);
+	io_pattern(payload, sizeof(payload), 2);
+	io_pattern(trailer, sizeof(trailer), 3);
+	memset(io_mem, 0, sizeof(io_mem));
+
+	ret = metal_io_block_writev(&io, 7, sg, metal_dim(sg));
+	if (ret != total || memcmp(io_mem + 7, hdr, sizeof(hdr)) ||
+	    memcmp(io_mem + 7 + sizeof(hdr), payload, sizeof(payload)) ||
+	    memcmp(io_mem + 7 + sizeof(hdr) + sizeof(payload), trailer,
+		   sizeof(trailer)))
+		return -EINVAL;
+
+	/* Scatter the same block back in a different split. */
+	memcpy(io_ref, io_mem + 7, total);
+	memset(io_buf, 0, sizeof(io_buf));
+	sg[0].virt = io_buf;
+	sg[0].len = 64;
+	sg[1].virt = io_buf + 100;
+	sg[1].len = total - 64;
+	ret = metal_io_block_readv(&io, 7, sg, 2);
+	if (ret != total || memcmp(io_buf, io_ref, 64) ||
+	    memcmp(io_buf + 100, io_ref + 64, total - 64))
+		return -EINVAL;
+
+	/* Vectors must fit in the region. */
+	if (metal_io_block_writev(&io, sizeof(io_mem) - 8, sg, 2) != -EINVAL)
+		return -EINVAL;
+	metal_io_finish(&io);
+
+	/* Short transfers stop the vector and count only what moved. */
+	metal_io_init(&io, METAL_BAD_VA, NULL, sizeof(io_buf), -1, 0,
+		      &io_short_ops);
+	sg[0].virt = hdr;
+	sg[0].len = sizeof(hdr);
+	sg[1].virt = payload;
+	sg[1].len = sizeof(payload);
+	memset(io_buf, 0, sizeof(io_buf));
+	ret = metal_io_block_writev(&io, 0, sg, 3);
+	if (ret != sizeof(hdr) + 100 || memcmp(io_buf, hdr, sizeof(hdr)) ||
+	    memcmp(io_buf + sizeof(hdr), payload, 100) ||
+	    io_buf[sizeof(hdr) + 100])
+		return -EINVAL;
+	memset(payload, 0, sizeof(payload));
+	ret = metal_io_block_readv(&io, sizeof(hdr), sg + 1, 2);
+	if (ret != 100 || memcmp(payload, io_buf + sizeof(hdr), 100) ||
+	    payload[100])
+		return -EINVAL;
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_block_vector);
+
+/* Region accessed only through block ops, backed by io_buf. */
+static int io_ops_block_read(struct metal_io_region *io, unsigned long offset,
+			     void *restrict dst, memory_order order, int len)
+{
+	(void)io;
+	atomic_thread_fence(order);
+	memcpy(dst, io_buf + offset, len);
+	return len;
+}
+
+static int io_ops_block_write(struct metal_io_region *io, unsigned long offset,
+			      const void *restrict src, memory_order order,
+			      int len)
+{
+	(void)io;
+	memcpy(io_buf + offset, src, len);
+	atomic_thread_fence(order);
+	return len;
+}
+
+static const struct metal_io_ops io_block_ops = {
+	.block_read	= io_ops_block_read,
+	.block_write	= io_ops_block_write,
+};
+
+static int io_block_copy(void)
+{
+	struct metal_io_region io, ops_io, lo_io, hi_io;
+	int ret;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	metal_io_init(&ops_io, METAL_BAD_VA, NULL, sizeof(io_buf), -1, 0,
+		      &io_block_ops);
+
+	/* Overlapping copy within one region. */
+	io_pattern(io_mem, sizeof(io_mem), 9);
+	memcpy(io_ref, io_mem, sizeof(io_ref));
+	memmove(io_ref + 3, io_ref, 500);
+	ret = metal_io_block_copy(&io, 3, &io, 0, 500);
+	if (ret != 500 || memcmp(io_mem, io_ref, sizeof(io_ref)))
+		return -EINVAL;
+
+	/* Direct to ops region, then ops to ops through the bounce buffer. */
+	memset(io_buf, 0, sizeof(io_buf));
+	ret = metal_io_block_copy(&ops_io, 1, &io, 2, 700);
+	if (ret != 700 || memcmp(io_buf + 1, io_mem + 2, 700))
+		return -EINVAL;
+	ret = metal_io_block_copy(&ops_io, 0, &ops_io, 1, 700);
+	if (ret != 700 || memcmp(io_buf, io_mem + 2, 700))
+		return -EINVAL;
+	ret = metal_io_block_copy(&ops_io, 5, &ops_io, 0, 700);
+	if (ret != 700 || memcmp(io_buf + 5, io_mem + 2, 700))
+		return -EINVAL;
+
+	/* Ops region to direct, clipped to the end of the destination. */
+	ret = metal_io_block_copy(&io, sizeof(io_mem) - 10, &ops_io, 0, 700);
+	if (ret != 10 || memcmp(io_mem + sizeof(io_mem) - 10, io_buf, 10))
+		return -EINVAL;
+
+	/* Overlapping views of one ops region copy like the region itself. */
+	if (metal_io_subregion(&ops_io, 0, 900, &lo_io) ||
+	    metal_io_subregion(&ops_io, 5, 900, &hi_io))
+		return -EINVAL;
+	io_pattern(io_buf, sizeof(io_buf), 13);
+	memcpy(io_ref, io_buf, sizeof(io_ref));
+	memmove(io_ref + 5, io_ref, 700);
+	ret = metal_io_block_copy(&hi_io, 0, &lo_io, 0, 700);
+	if (ret != 700 || memcmp(io_buf, io_ref, sizeof(io_ref)))
+		return -EINVAL;
+	metal_io_finish(&hi_io);
+	metal_io_finish(&lo_io);
+
+	if (metal_io_block_copy(&io, 0, &ops_io, 0, -1) != -EINVAL)
+		return -EINVAL;
+
+	metal_io_finish(&ops_io);
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_block_copy);
+
+static const int io_atomic_count = 1000;
+
+static void *io_atomic_thread(void *arg)
+{
+	struct metal_io_region *io = arg;
+	uint64_t exp;
+	int i;
+
+	for (i = 0; i < io_atomic_count; i++) {
+		metal_io_fetch_add(io, 0, 1, memory_order_relaxed, 4);
+		metal_io_fetch_add(io, 8, 1, memory_order_acq_rel, 8);
+		metal_io_fetch_add(io, 16, 1, memory_order_relaxed, 2);
+		exp = metal_io_read32(io, 24);
+		while (!metal_io_cmpxchg(io, 24, &exp, exp + 1,
+					 memory_order_acq_rel, 4))
+			;
+	}
+	return NULL;
+}
+
+static int io_atomic(void)
+{
+	const int threads = 10;
+	struct metal_io_region io;
+	uint64_t exp, old;
+	int error;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	memset(io_mem, 0, sizeof(io_mem));
+
+	error = metal_run(threads, io_atomic_thread, &io);
+	if (error)
+		return error;
+	if (metal_io_read32(&io, 0) != (uint32_t)(threads * io_atomic_count) ||
+	    metal_io_read64(&io, 8) != (uint64_t)(threads * io_atomic_count) ||
+	    metal_io_read16(&io, 16) != (uint16_t)(threads * io_atomic_count) ||
+	    metal_io_read32(&io, 24) != (uint32_t)(threads * io_atomic_count))
+		return -EINVAL;
+
+	/* Byte wide bit operations and exchange. */
+	metal_io_write8(&io, 32, 0x0f);
+	old = metal_io_fetch_or(&io, 32, 0xf0, memory_order_seq_cst, 1);
+	if (old != 0x0f || metal_io_read8(&io, 32) != 0xff)
+		return -EINVAL;
+	old = metal_io_fetch_and(&io, 32, 0x3c, memory_order_seq_cst, 1);
+	if (old != 0xff || metal_io_read8(&io, 32) != 0x3c)
+		return -EINVAL;
+	old = metal_io_exchange(&io, 32, 0x5a, memory_order_seq_cst, 1);
+	if (old != 0x3c || metal_io_read8(&io, 32) != 0x5a)
+		return -EINVAL;
+
+	/* A failed compare and exchange returns the current value. */
+	exp = 1;
+	if (metal_io_cmpxchg(&io, 32, &exp, 2, memory_order_release, 1) ||
+	    exp != 0x5a || metal_io_read8(&io, 32) != 0x5a)
+		return -EINVAL;
+
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_atomic);
+
+static int io_physmap(void)
+{
+	/* Pages 0-1 and 4-5 are contiguous, page 3 is not mapped. */
+	const metal_phys_addr_t physmap[] = {
+		0x90000, 0x90100, 0x20000, METAL_BAD_PHYS, 0x40000, 0x40100,
+	};
+	const struct metal_io_extent extents[] = {
+		{ .offset = 0x200, .size = 0x100, .phys = 0x10000 },
+		{ .offset = 0x000, .size = 0x200, .phys = 0x30000 },
+	};
+	struct metal_io_region io;
+	metal_phys_addr_t phys;
+	unsigned long offset;
+
+	/* A discontiguous physmap is compacted into sorted extents. */
+	metal_io_init(&io, io_mem, physmap, 0x600, 8, 0, NULL);
+	if (io.num_extents != 3 || !io.extents)
+		return -EINVAL;
+	for (offset = 0; offset < 0x600; offset += 0x40) {
+		phys = metal_io_phys(&io, offset);
+		if (offset >> 8 == 3) {
+			if (phys != METAL_BAD_PHYS)
+				return -EINVAL;
+			continue;
+		}
+		if (phys != physmap[offset >> 8] + (offset & 0xff) ||
+		    metal_io_phys_to_offset(&io, phys) != offset)
+			return -EINVAL;
+	}
+	if (metal_io_phys_to_offset(&io, 0x40200) != METAL_BAD_OFFSET ||
+	    metal_io_phys_to_offset(&io, 0x1000) != METAL_BAD_OFFSET ||
+	    metal_io_phys(&io, 0x600) != 0x40200 ||
+	    metal_io_phys(&io, 0x601) != METAL_BAD_PHYS)
+		return -EINVAL;
+	metal_io_finish(&io);
+
+	/* A single page region needs no extent table. */
+	metal_io_init(&io, io_mem, physmap, sizeof(io_mem), -1, 0, NULL);
+	if (io.num_extents != 1 || io.extents ||
+	    metal_io_phys(&io, 0x123) != 0x90123 ||
+	    metal_io_phys_to_offset(&io, 0x90123) != 0x123)
+		return -EINVAL;
+	metal_io_finish(&io);
+
+	if (metal_io_init_extents(&io, io_mem, extents, metal_dim(extents),
+				  0x300, 0, NULL))
+		return -EINVAL;
+	if (metal_io_phys(&io, 0x1ff) != 0x301ff ||
+	    metal_io_phys(&io, 0x200) != 0x10000 ||
+	    metal_io_phys_to_offset(&io, 0x10080) != 0x280 ||
+	    metal_io_phys_to_offset(&io, 0x30080) != 0x80 ||
+	    metal_io_phys_to_virt(&io, 0x10000) != io_mem + 0x200)
+		return -EINVAL;
+	metal_io_finish(&io);
+
+	return 0;
+}
+METAL_ADD_TEST(io_physmap);
+
+static uint64_t io_ops_read(struct metal_io_region *io, unsigned long offset,
+			    memory_order order, int width)
+{
+	(void)io;
+	(void)offset;
+	(void)order;
+	(void)width;
+	return 0;
+}
+
+static int io_direct(void)
+{
+	const struct metal_io_ops ops = {
+		.read	= io_ops_read,
+	};
+	struct metal_io_region io, ops_io;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	metal_io_init(&ops_io, io_mem, NULL, sizeof(io_mem), -1, 0, &ops);
+	if (!metal_io_is_direct(&io) || metal_io_is_direct(&ops_io))
+		return -EINVAL;
+
+	metal_io_write8_direct(&io, 1, 0x12);
+	metal_io_write16_direct(&io, 2, 0x3456);
+	metal_io_write32_direct_explicit(&io, 4, 0x789abcde,
+					 memory_order_release);
+	metal_io_write64_direct(&io, 8, 0x0123456789abcdefULL);
+	if (metal_io_read8(&io, 1) != 0x12 ||
+	    metal_io_read16(&io, 2) != 0x3456 ||
+	    metal_io_read32(&io, 4) != 0x789abcde ||
+	    metal_io_read64(&io, 8) != 0x0123456789abcdefULL)
+		return -EINVAL;
+
+	metal_io_write32(&io, 16, 0xfeedface);
+	if (metal_io_read8_direct(&io, 1) != 0x12 ||
+	    metal_io_read16_direct(&io, 2) != 0x3456 ||
+	    metal_io_read32_direct_explicit(&io, 16, memory_order_acquire) !=
+	    0xfeedface ||
+	    metal_io_read64_direct(&io, 8) != 0x0123456789abcdefULL)
+		return -EINVAL;
+
+	metal_io_finish(&ops_io);
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_direct);
+
+static int io_batch_calls;
+
+static int io_ops_batch(struct metal_io_region *io,
+			struct metal_io_batch_op *ops, int nops)
+{
+	int i;
+
+	io_batch_calls++;
+	for (i = 0; i < nops; i++)
+		ops[i].result = metal_io_read32_direct(io, ops[i].offset);
+	return 0;
+}
+
+static int io_batch(void)
+{
+	struct metal_io_batch_op ops[] = {
+		{ .type = METAL_IO_BATCH_WRITE, .width = 4, .offset = 0,
+		  .value = 0x00ff00ff },
+		{ .type = METAL_IO_BATCH_SET_BITS, .width = 4, .offset = 0,
+		  .value = 0x0f000000 },
+		{ .type = METAL_IO_BATCH_CLEAR_BITS, .width = 2, .offset = 0,
+		  .value = 0x000f },
+		{ .type = METAL_IO_BATCH_POLL, .width = 4, .offset = 0,
+		  .mask = 0x0f0000f0, .value = 0x0f0000f0, .max_polls = 1 },
+		{ .type = METAL_IO_BATCH_READ, .width = 1, .offset = 3 },
+	};
+	struct metal_io_batch_op poll = {
+		.type = METAL_IO_BATCH_POLL, .width = 8, .offset = 8,
+		.mask = 1, .value = 1, .max_polls = 3,
+	};
+	const struct metal_io_ops batch_ops = {
+		.batch	= io_ops_batch,
+	};
+	struct metal_io_region io;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	if (metal_io_batch(&io, ops, metal_dim(ops)))
+		return -EINVAL;
+	if (metal_io_read32(&io, 0) != 0x0fff00f0 ||
+	    ops[1].result != 0x00ff00ff || ops[2].result != 0x00ff ||
+	    ops[3].result != 0x0fff00f0 || ops[4].result != 0x0f)
+		return -EINVAL;
+
+	metal_io_write64(&io, 8, 0);
+	if (metal_io_batch(&io, &poll, 1) != -ETIMEDOUT || poll.result)
+		return -EINVAL;
+	poll.offset = sizeof(io_mem) - 4;
+	if (metal_io_batch(&io, &poll, 1) != -ERANGE)
+		return -EINVAL;
+
+	/* The ops hook runs the whole batch in one call. */
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, &batch_ops);
+	ops[0].result = 0;
+	if (metal_io_batch(&io, ops, metal_dim(ops)) || io_batch_calls != 1 ||
+	    ops[0].result != 0x0fff00f0)
+		return -EINVAL;
+
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_batch);
+
+static void *io_wait_thread(void *arg)
+{
+	struct metal_io_region *io = arg;
+
+	metal_sleep_usec(2000);
+	metal_io_write32(io, 0, 0x80000001);
+	return NULL;
+}
+
+static int io_wait_for(void)
+{
+	struct metal_io_region io;
+	pthread_t tid;
+	long long ret;
+	int ts_created;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	metal_io_write32(&io, 0, 1);
+
+	ret = metal_io_wait_for(&io, 0, 1, 1, 4, 0);
+	if (ret < 0)
+		return -EINVAL;
+	ret = metal_io_wait_for(&io, 0, 0x80000000, 0x80000000, 4, 1000000);
+	if (ret != -ETIMEDOUT)
+		return -EINVAL;
+	if (metal_io_wait_for(&io, sizeof(io_mem) - 2, 1, 1, 4, 0) != -ERANGE ||
+	    metal_io_wait_for(&io, 0, 1, 1, 3, 0) != -EINVAL)
+		return -EINVAL;
+
+	/* Wake up once another thread sets the bit. */
+	if (metal_run_noblock(1, io_wait_thread, &io, &tid, &ts_created))
+		return -EINVAL;
+	ret = metal_io_wait_for(&io, 0, 0x80000000, 0x80000000, 4,
+				5000000000ULL);
+	metal_finish_threads(ts_created, &tid);
+	if (ret < 1000000 || ret >= 5000000000LL)
+		return -EINVAL;
+
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_wait_for);
+
+static int io_access_widths(void)
+{
+	const unsigned int widths[] = {
+		METAL_IO_ACCESS_32,
+		METAL_IO_ACCESS_64,
+		METAL_IO_ACCESS_32 | METAL_IO_ACCESS_64,
+		METAL_IO_ACCESS_16 | METAL_IO_ACCESS_64,
+	};
+	const int lens[] = { 0, 1, 3, 4, 7, 8, 9, 15, 16, 17, 33, 100 };
+	struct metal_io_region io;
+	unsigned int i, j, off;
+	int len;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	if (metal_io_set_access_widths(&io, 3 << 4) != -EINVAL)
+		return -EINVAL;
+
+	for (i = 0; i < metal_dim(widths); i++) {
+		metal_io_set_access_widths(&io, widths[i]);
+		if (metal_io_enable_stream(&io) != -EINVAL)
+			return -EINVAL;
+		for (j = 0; j < metal_dim(lens); j++) {
+			len = lens[j];
+			for (off = 0; off < 16; off++) {
+				memset(io_mem, 0xa5, sizeof(io_mem));
+				io_pattern(io_buf, sizeof(io_buf), len + off);
+				memcpy(io_ref, io_mem, sizeof(io_ref));
+				memcpy(io_ref + off, io_buf, len);
+				if (metal_io_block_write(&io, off, io_buf,
+							 len) != len ||
+				    memcmp(io_mem, io_ref, sizeof(io_ref)))
+					return -EINVAL;
+
+				memset(io_buf, 0, sizeof(io_buf));
+				if (metal_io_block_read(&io, off, io_buf,
+							len) != len ||
+				    memcmp(io_buf, io_ref + off, len))
+					return -EINVAL;
+
+				memset(io_ref + off, 0x3c, len);
+				if (metal_io_block_set(&io, off, 0x3c,
+						       len) != len ||
+				    memcmp(io_mem, io_ref, sizeof(io_ref)))
+					return -EINVAL;
+			}
+		}
+	}
+
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_access_widths);
+
+static int io_block_crc32c(void)
+{
+	const char check[] = "123456789";
+	struct metal_io_region io, ops_io;
+	uint32_t crc, ref;
+	unsigned int i;
+	int len;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	metal_io_init(&ops_io, METAL_BAD_VA, NULL, sizeof(io_buf), -1, 0,
+		      &io_block_ops);
+
+	crc = 0;
+	if (metal_io_block_write_crc32c(&io, 3, check, 9, &crc) != 9 ||
+	    crc != 0xe3069283 || memcmp(io_mem + 3, check, 9))
+		return -EINVAL;
+
+	/* Any split of a block gives the same checksum. */
+	io_pattern(io_mem, sizeof(io_mem), 17);
+	ref = 0;
+	metal_io_block_read_crc32c(&io, 0, io_ref, sizeof(io_ref), &ref);
+	if (memcmp(io_ref, io_mem, sizeof(io_ref)))
+		return -EINVAL;
+	for (len = 1; len < 100; len += 7) {
+		crc = 0;
+		for (i = 0; i < sizeof(io_mem); i += len)
+			metal_io_block_read_crc32c(&io, i, io_buf, len, &crc);
+		if (crc != ref)
+			return -EINVAL;
+	}
+
+	/* Regions with block ops are checksummed after the copy. */
+	crc = 0;
+	if (metal_io_block_write_crc32c(&ops_io, 0, io_mem, sizeof(io_mem),
+					&crc) != sizeof(io_mem) || crc != ref)
+		return -EINVAL;
+	crc = 0;
+	if (metal_io_block_read_crc32c(&ops_io, 0, io_ref, sizeof(io_ref),
+				       &crc) != sizeof(io_ref) || crc != ref)
+		return -EINVAL;
+
+	metal_io_finish(&ops_io);
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_block_crc32c);
+
+static int io_endian(void)
+{
+	const int widths[] = { 2, 4, 8 };
+	struct metal_io_region io, ops_io;
+	unsigned int i, j, len;
+	int width, k;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	metal_io_init(&ops_io, METAL_BAD_VA, NULL, sizeof(io_buf), -1, 0,
+		      &io_block_ops);
+
+	io_mem[0] = 0x12;
+	io_mem[1] = 0x34;
+	io_mem[2] = 0x56;
+	io_mem[3] = 0x78;
+	if (metal_io_read32be(&io, 0) != 0x12345678 ||
+	    metal_io_read32le(&io, 0) != 0x78563412 ||
+	    metal_io_read16be(&io, 2) != 0x5678)
+		return -EINVAL;
+	metal_io_write64be(&io, 8, 0x0102030405060708ULL);
+	if (io_mem[8] != 0x01 || io_mem[15] != 0x08 ||
+	    metal_io_read64le(&io, 8) != 0x0807060504030201ULL)
+		return -EINVAL;
+
+	/* Native regions copy unchanged. */
+	io_pattern(io_buf, sizeof(io_buf), 5);
+	if (metal_io_block_write_endian(&io, 0, io_buf, 64, 4) != 64 ||
+	    memcmp(io_mem, io_buf, 64))
+		return -EINVAL;
+	if (metal_io_block_write_endian(&io, 0, io_buf, 6, 4) != -EINVAL ||
+	    metal_io_block_write_endian(&io, 0, io_buf, 6, 3) != -EINVAL)
+		return -EINVAL;
+
+#ifdef METAL_BIG_ENDIAN
+	metal_io_set_endian(&io, METAL_IO_ENDIAN_LITTLE);
+	metal_io_set_endian(&ops_io, METAL_IO_ENDIAN_LITTLE);
+#else
+	metal_io_set_endian(&io, METAL_IO_ENDIAN_BIG);
+	metal_io_set_endian(&ops_io, METAL_IO_ENDIAN_BIG);
+#endif
+	for (i = 0; i < metal_dim(widths); i++) {
+		width = widths[i];
+		for (len = 0; len <= 400; len += width) {
+			io_pattern(io_ref, sizeof(io_ref), len);
+			if (metal_io_block_write_endian(&io, 8, io_ref, len,
+							width) != (int)len)
+				return -EINVAL;
+			for (j = 0; j < len; j += width)
+				for (k = 0; k < width; k++)
+					if (io_mem[8 + j + k] !=
+					    io_ref[j + width - 1 - k])
+						return -EINVAL;
+
+			memset(io_buf, 0, len);
+			if (metal_io_block_read_endian(&io, 8, io_buf, len,
+						       width) != (int)len ||
+			    memcmp(io_buf, io_ref, len))
+				return -EINVAL;
+		}
+
+		/* Regions with block ops swap through a bounce buffer. */
+		io_pattern(io_ref, sizeof(io_ref), width);
+		if (metal_io_block_write_endian(&ops_io, 0, io_ref, 600,
+						width) != 600 ||
+		    metal_io_block_read_endian(&ops_io, 0, io_mem, 600,
+					       width) != 600 ||
+		    memcmp(io_mem, io_ref, 600) ||
+		    io_buf[0] != io_ref[width - 1])
+			return -EINVAL;
+	}
+
+	metal_io_finish(&ops_io);
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_endian);
+
+static int io_block_2d(void)
+{
+	struct metal_io_region io, ops_io;
+	struct metal_io_region *regions[] = { &io, &ops_io };
+	uint8_t *mem[] = { io_mem, io_buf };
+	const int width = 13, height = 9, pitch = 40, buf_pitch = 16;
+	uint8_t tile[9 * 16], out[9 * 16];
+	unsigned int i;
+	int row;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	metal_io_init(&ops_io, METAL_BAD_VA, NULL, sizeof(io_buf), -1, 0,
+		      &io_block_ops);
+	io_pattern(tile, sizeof(tile), 3);
+
+	for (i = 0; i < metal_dim(regions); i++) {
+		memset(mem[i], 0xa5, IO_TEST_SIZE);
+		memcpy(io_ref, mem[i], sizeof(io_ref));
+		for (row = 0; row < height; row++)
+			memcpy(io_ref + 5 + row * pitch, tile + row * buf_pitch,
+			       width);
+		if (metal_io_block_write2d(regions[i], 5, pitch, tile,
+					   buf_pitch, width, height) !=
+		    width * height ||
+		    memcmp(mem[i], io_ref, sizeof(io_ref)))
+			return -EINVAL;
+
+		memset(out, 0, sizeof(out));
+		if (metal_io_block_read2d(regions[i], 5, pitch, out,
+					  buf_pitch, width, height) !=
+		    width * height)
+			return -EINVAL;
+		for (row = 0; row < height; row++)
+			if (memcmp(out + row * buf_pitch,
+				   tile + row * buf_pitch, width))
+				return -EINVAL;
+	}
+
+	/* The last row must fit, and rows may not overlap. */
+	if (metal_io_block_read2d(&io, IO_TEST_SIZE - 8 * pitch - width + 1,
+				  pitch, out, buf_pitch, width,
+				  height) != -ERANGE ||
+	    metal_io_block_read2d(&io, IO_TEST_SIZE - 8 * pitch - width,
+				  pitch, out, buf_pitch, width,
+				  height) != width * height ||
+	    metal_io_block_read2d(&io, 0, 8, out, buf_pitch, width,
+				  height) != -EINVAL)
+		return -EINVAL;
+
+	metal_io_finish(&ops_io);
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_block_2d);
+
+static int io_prefetch(void)
+{
+	struct metal_io_region io, ops_io;
+	uint8_t out[100];
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	metal_io_init(&ops_io, METAL_BAD_VA, NULL, sizeof(io_buf), -1, 0,
+		      &io_block_ops);
+	io_pattern(io_mem, sizeof(io_mem), 5);
+
+	/* Prefetches are hints, clamped to the region and never fault. */
+	metal_io_prefetch(&io, 0, sizeof(io_mem), 0);
+	metal_io_prefetch(&io, 3, sizeof(io_mem), 1);
+	metal_io_prefetch(&io, sizeof(io_mem), 64, 0);
+	metal_io_prefetch(&io, sizeof(io_mem) + 64, 64, 1);
+	metal_io_prefetch(&ops_io, 0, sizeof(io_buf), 0);
+
+	if (metal_io_block_read_ahead(&io, 10, out, sizeof(out), 256) !=
+	    sizeof(out) || memcmp(out, io_mem + 10, sizeof(out)))
+		return -EINVAL;
+	if (metal_io_block_read_ahead(&io, sizeof(io_mem) - 50, out,
+				      sizeof(out), 256) != 50 ||
+	    memcmp(out, io_mem + sizeof(io_mem) - 50, 50))
+		return -EINVAL;
+
+	memcpy(io_buf, io_mem, sizeof(io_buf));
+	if (metal_io_block_read_ahead(&ops_io, 10, out, sizeof(out), 256) !=
+	    sizeof(out) || memcmp(out, io_buf + 10, sizeof(out)))
+		return -EINVAL;
+
+	metal_io_finish(&ops_io);
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_prefetch);
+
+static int io_span(void)
+{
+	struct metal_io_region io, ops_io, narrow_io;
+	uint8_t *ptr;
+
+	metal_io_init(&io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	metal_io_init(&ops_io, METAL_BAD_VA, NULL, sizeof(io_buf), -1, 0,
+		      &io_block_ops);
+	metal_io_init(&narrow_io, io_mem, NULL, sizeof(io_mem), -1, 0, NULL);
+	metal_io_set_access_widths(&narrow_io, METAL_IO_ACCESS_32);
+
+	/* Directly mapped spans are borrowed in place. */
+	if (metal_io_span_get(&io, 16, 32, METAL_IO_SPAN_WRITE,
+			      (void **)&ptr) ||
+	    ptr != io_mem + 16)
+		return -EINVAL;
+	memset(ptr, 0x3c, 32);
+	if (metal_io_span_put(&io, 16, 32, METAL_IO_SPAN_WRITE, ptr) ||
+	    io_mem[16] != 0x3c || io_mem[47] != 0x3c)
+		return -EINVAL;
+	if (metal_io_span_get(&io, sizeof(io_mem) - 8, 9, METAL_IO_SPAN_READ,
+			      (void **)&ptr) != -ERANGE ||
+	    metal_io_span_get(&io, sizeof(io_mem) + 1, 0, METAL_IO_SPAN_READ,
+			      (void **)&ptr) != -ERANGE)
+		return -EINVAL;
+
+	/* Others are staged, and only written back when borrowed to write. */
+	io_pattern(io_buf, sizeof(io_buf), 9);
+	memcpy(io_ref, io_buf, sizeof(io_ref));
+	if (metal_io_span_get(&ops_io, 100, 64, METAL_IO_SPAN_READ,
+			      (void **)&ptr) ||
+	    memcmp(ptr, io_buf + 100, 64))
+		return -EINVAL;
+	memset(ptr, 0, 64);
+	if (metal_io_span_put(&ops_io, 100, 64, METAL_IO_SPAN_READ, ptr) ||
+	    memcmp(io_buf, io_ref, sizeof(io_ref)))
+		return -EINVAL;
+	if (metal_io_span_get(&ops_io, 100, 64,
+			      METAL_IO_SPAN_READ | METAL_IO_SPAN_WRITE,
+			      (void **)&ptr))
+		return -EINVAL;
+	ptr[0] ^= 0xff;
+	io_ref[100] ^= 0xff;
+	if (metal_io_span_put(&ops_io, 100, 64,
+			      METAL_IO_SPAN_READ | METAL_IO_SPAN_WRITE, ptr) ||
+	    memcmp(io_buf, io_ref, sizeof(io_ref)))
+		return -EINVAL;
+
+	if (metal_io_span_get(&narrow_io, 8, 16, METAL_IO_SPAN_READ,
+			      (void **)&ptr) ||
+	    ptr == io_mem + 8 || memcmp(ptr, io_mem + 8, 16) ||
+	    metal_io_span_put(&narrow_io, 8, 16, METAL_IO_SPAN_READ, ptr))
+		return -EINVAL;
+
+	metal_io_finish(&narrow_io);
+	metal_io_finish(&ops_io);
+	metal_io_finish(&io);
+	return 0;
+}
+METAL_ADD_TEST(io_span);
+
+static int io_subregion(void)
+{
+	const metal_phys_addr_t physmap[] = {
+		0x90000, 0x90100, 0x20000, 0x50000,
+	};
+	struct metal_io_region io, ops_io, child, grandchild;
+	unsigned long offset;
+	uint8_t out[16];
+
+	metal_io_init(&io, io_mem, physmap, 0x400, 8, 0, NULL);
+	if (metal_io_subregion(&io, 0x180, 0x200, &child))
+		return -EINVAL;
+
+	/* Offsets, translations and bounds are relative to the view. */
+	for (offset = 0; offset < 0x200; offset += 0x10)
+		if (metal_io_phys(&child, offset) !=
+		    metal_io_phys(&io, 0x180 + offset) ||
+		    metal_io_phys_to_offset(&child,
+					    metal_io_phys(&io, 0x180 + offset))
+		    != offset)
+			return -EINVAL;
+	if (metal_io_virt(&child, 0) != io_mem + 0x180 ||
+	    metal_io_phys(&child, 0x200) != 0x50080 ||
+	    metal_io_phys(&child, 0x201) != METAL_BAD_PHYS ||
+	    metal_io_phys_to_offset(&child, 0x90000) != METAL_BAD_OFFSET ||
+	    metal_io_phys_to_offset(&child, 0x5007f) != 0x1ff ||
+	    metal_io_phys_to_offset(&child, 0x50080) != METAL_BAD_OFFSET)
+		return -EINVAL;
+	metal_io_write32(&child, 4, 0x12345678);
+	if (metal_io_read32(&io, 0x184) != 0x12345678)
+		return -EINVAL;
+
+	/* Views of views, and views that do not fit. */
+	if (metal_io_subregion(&child, 0x10, 0x20, &grandchild) ||
+	    metal_io_phys(&grandchild, 0) != 0x90190 ||
+	    metal_io_subregion(&child, 0x100, 0x101, &grandchild) != -ERANGE ||
+	    metal_io_subregion(&child, 0x201, 0, &grandchild) != -ERANGE)
+		return -EINVAL;
+
+	/* Closing a view leaves the parent's extents alone. */
+	metal_io_finish(&grandchild);
+	metal_io_finish(&child);
+	if (metal_io_phys(&io, 0x380) != 0x50080)
+		return -EINVAL;
+	metal_io_finish(&io);
+
+	/* Accesses to views of regions with ops go through the parent. */
+	metal_io_init(&ops_io, METAL_BAD_VA, NULL, sizeof(io_buf), -1, 0,
+		      &io_block_ops);
+	io_pattern(io_buf, sizeof(io_buf), 11);
+	if (metal_io_subregion(&ops_io, 64, 128, &child) ||
+	    metal_io_virt(&child, 0) ||
+	    metal_io_block_read(&child, 8, out, sizeof(out)) != sizeof(out) ||
+	    memcmp(out, io_buf + 72, sizeof(out)) ||
+	    metal_io_block_read(&child, 120, out, sizeof(out)) != 8)
+		return -EINVAL;
+	metal_io_finish(&child);
+	metal_io_finish(&ops_io);
+	return 0;
+}
+METAL_ADD_TEST(io_subregion);
+
+static int io_parallel(void)
+{
+	const size_t size = METAL_IO_PARALLEL_THRESHOLD + 4096 + 123;
+	struct metal_io_region src_io, dst_io;
+	uint8_t *src, *dst;
+	int ret = -ENOMEM;
+	size_t i;
+
+	src = malloc(size);
+	dst = malloc(size);
+	if (!src || !dst)
+		goto out;
+
+	metal_io_init(&src_io, src, NULL, size, -1, 0, NULL);
+	metal_io_init(&dst_io, dst, NULL, size, -1, 0, NULL);
+	metal_io_set_parallel(&src_io, 4);
+	metal_io_set_parallel(&dst_io, 4);
+
+	ret = -EINVAL;
+	memset(src, 0, size);
+	if (metal_io_block_set(&src_io, 0, 0x5a, size) != (int)size)
+		goto finish;
+	for (i = 0; i < size; i++)
+		if (src[i] != 0x5a)
+			goto finish;
+
+	io_pattern(src, size, 7);
+	memset(dst, 0, size);
+	if (metal_io_block_copy(&dst_io, 0, &src_io, 0, size) != (int)size ||
+	    memcmp(dst, src, size))
+		goto finish;
+
+	/* Smaller than the threshold is done by the caller alone. */
+	if (metal_io_block_set(&dst_io, 1, 0xc3, 1000) != 1000 ||
+	    dst[0] != src[0] || dst[1] != 0xc3 || dst[1000] != 0xc3 ||
+	    dst[1001] != src[1001])
+		goto finish;
+	ret = 0;
+
+finish:
+	metal_io_finish(&dst_io);
+	metal_io_finish(&src_io);
+out:
+	free(dst);
+	free(src);
+	return ret;
+}
+METAL_ADD_TEST(io_parallel);
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2018, Xilinx Inc. and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "metal-test.h"
+#include <metal/atomic.h>
+#include <metal/io_async.h>
+#include <metal/irq.h>
+#include <metal/log.h>
+#include <metal/sleep.h>
+#include <metal/sys.h>
+
+#define ASYNC_SIZE	(64 * 1024)
+#define ASYNC_JOBS	8
+
+static uint8_t async_src[ASYNC_SIZE], async_dst[ASYNC_SIZE];
+static atomic_int async_reaped;
+
+static int io_async_irq(int irq, void *priv)
+{
+	struct metal_io_async *async = priv;
+
+	(void)irq;
+	while (metal_io_async_reap(async))
+		atomic_fetch_add(&async_reaped, 1);
+	return METAL_IRQ_HANDLED;
+}
+
+static int io_async(void)
+{
+	struct metal_io_async_job jobs[ASYNC_JOBS], *job;
+	struct metal_io_region src_io, dst_io;
+	struct metal_io_async async;
+	const int chunk = ASYNC_SIZE / ASYNC_JOBS;
+	struct pollfd pfd;
+	int error, i, n;
+
+	for (i = 0; i < ASYNC_SIZE; i++)
+		async_src[i] = i * 7 + 3;
+	metal_io_init(&src_io, async_src, NULL, ASYNC_SIZE, -1, 0, NULL);
+	metal_io_init(&dst_io, async_dst, NULL, ASYNC_SIZE, -1, 0, NULL);
+
+	error = metal_io_async_init(&async, NULL, 2);
+	if (error)
+		return error;
+	error = -EINVAL;
+	if (metal_io_async_fd(&async) < 0 || metal_io_async_reap(&async))
+		goto out;
+
+	/* Completions are polled through the fd, then reaped. */
+	for (i = 0; i < ASYNC_JOBS; i++)
+		if (metal_io_async_copy(&async, &jobs[i], &dst_io, i * chunk,
+					&src_io, i * chunk, chunk))
+			goto out;
+	for (n = 0; n < ASYNC_JOBS; ) {
+		pfd.fd = metal_io_async_fd(&async);
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 5000) != 1)
+			goto out;
+		while ((job = metal_io_async_reap(&async))) {
+			if (job->result != chunk)
+				goto out;
+			n++;
+		}
+	}
+	pfd.revents = 0;
+	if (poll(&pfd, 1, 0) != 0 ||
+	    memcmp(async_dst, async_src, ASYNC_SIZE))
+		goto out;
+
+	/* Or waited for one at a time. */
+	if (metal_io_async_set(&async, &jobs[0], &dst_io, 100, 0x5a, 1000) ||
+	    metal_io_async_wait(&async, &jobs[0]) != 1000 ||
+	    async_dst[99] != async_src[99] || async_dst[100] != 0x5a ||
+	    async_dst[1099] != 0x5a || async_dst[1100] != async_src[1100])
+		goto out;
+	if (metal_io_async_set(&async, &jobs[0], &dst_io, ASYNC_SIZE + 1, 0,
+			       1) ||
+	    metal_io_async_wait(&async, &jobs[0]) != -ERANGE)
+		goto out;
+
+	/* Or handled as an interrupt. */
+	atomic_store(&async_reaped, 0);
+	if (metal_irq_register(metal_io_async_fd(&async), io_async_irq, NULL,
+			       &async))
+		goto out;
+	for (i = 0; i < ASYNC_JOBS; i++)
+		if (metal_io_async_set(&async, &jobs[i], &dst_io, i * chunk,
+				       i, chunk))
+			goto out_irq;
+	for (n = 0; n < 5000 && atomic_load(&async_reaped) < ASYNC_JOBS; n++)
+		metal_sleep_usec(1000);
+	if (atomic_load(&async_reaped) != ASYNC_JOBS)
+		goto out_irq;
+	for (i = 0; i < ASYNC_SIZE; i++)
+		if (async_dst[i] != i / chunk)
+			goto out_irq;
+	error = 0;
+
+out_irq:
+	metal_irq_unregister(metal_io_async_fd(&async), io_async_irq, NULL,
+			     &async);
+out:
+	metal_io_async_finish(&async);
+	metal_io_finish(&dst_io);
+	metal_io_finish(&src_io);
+	return error;
+}
+METAL_ADD_TEST(io_async);
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2018, Xilinx Inc. and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <errno.h>
+#include <stdint.h>
+
+#include "metal-test.h"
+#include <metal/io.h>
+#include <metal/log.h>
+#include <metal/regcache.h>
+#include <metal/sys.h>
+
+static uint32_t regs[64];
+
+static int regcache(void)
+{
+	struct metal_io_region dev, *io;
+	struct metal_regcache cache;
+	int error;
+
+	metal_io_init(&dev, regs, NULL, sizeof(regs), -1, 0, NULL);
+
+	error = metal_regcache_init(&cache, &dev, 4,
+				    METAL_REGCACHE_WRITE_THROUGH);
+	if (error)
+		return error;
+	io = metal_regcache_io(&cache);
+	if (metal_regcache_set_cacheable(&cache, 0, 16, 1) ||
+	    metal_regcache_set_cacheable(&cache, 0, sizeof(regs) + 4, 1) !=
+	    -ERANGE)
+		return -EINVAL;
+
+	/* Cacheable reads are served from memory after the first miss. */
+	regs[1] = 0x11;
+	if (metal_io_read32(io, 4) != 0x11)
+		return -EINVAL;
+	regs[1] = 0x22;
+	if (metal_io_read32(io, 4) != 0x11 ||
+	    cache.hits != 1 || cache.misses != 1)
+		return -EINVAL;
+
+	/* Volatile registers are always read from the device. */
+	regs[8] = 0x33;
+	if (metal_io_read32(io, 32) != 0x33)
+		return -EINVAL;
+	regs[8] = 0x44;
+	if (metal_io_read32(io, 32) != 0x44 || cache.misses != 1)
+		return -EINVAL;
+
+	/* Writes go through, and update the cache. */
+	metal_io_write32(io, 8, 0x55);
+	regs[2] = 0;
+	if (regs[0] != 0 || metal_io_read32(io, 8) != 0x55 || cache.hits != 2)
+		return -EINVAL;
+	metal_regcache_invalidate(&cache);
+	if (metal_io_read32(io, 8) != 0)
+		return -EINVAL;
+	metal_regcache_finish(&cache);
+
+	/* Write back holds writes until sync. */
+	error = metal_regcache_init(&cache, &dev, 4, METAL_REGCACHE_WRITE_BACK);
+	if (error)
+		return error;
+	io = metal_regcache_io(&cache);
+	metal_regcache_set_cacheable(&cache, 0, sizeof(regs), 1);
+	regs[3] = 0;
+	metal_io_write32(io, 12, 0x66);
+	if (regs[3] != 0 || metal_io_read32(io, 12) != 0x66)
+		return -EINVAL;
+	metal_regcache_sync(&cache);
+	if (regs[3] != 0x66)
+		return -EINVAL;
+
+	/* Accesses of another width write back the registers they touch. */
+	metal_io_write32(io, 16, 0x12345678);
+	if (metal_io_read16(io, 18) != 0x1234 || regs[4] != 0x12345678)
+		return -EINVAL;
+	metal_io_write32(io, 20, 0x77);
+	metal_regcache_finish(&cache);
+	if (regs[5] != 0x77)
+		return -EINVAL;
+
+	metal_io_finish(&dev);
+	return 0;
+}
+METAL_ADD_TEST(regcache);
+
+static int regcache_subregion(void)
+{
+	const metal_phys_addr_t phys = 0x80000000;
+	struct metal_io_region dev, view, *io;
+	struct metal_regcache cache;
+	int error;
+
+	/* A cache of a view translates like the view. */
+	metal_io_init(&dev, regs, &phys, sizeof(regs), -1, 0, NULL);
+	if (metal_io_subregion(&dev, 0x40, 0x80, &view))
+		return -EINVAL;
+	error = metal_regcache_init(&cache, &view, 4,
+				    METAL_REGCACHE_WRITE_THROUGH);
+	if (error)
+		return error;
+	io = metal_regcache_io(&cache);
+	regs[0x44 / 4] = 0x88;
+	if (metal_io_phys(io, 0) != phys + 0x40 ||
+	    metal_io_phys(io, 0x10) != phys + 0x50 ||
+	    metal_io_phys_to_offset(io, phys + 0x44) != 4 ||
+	    metal_io_phys_to_offset(io, phys) != METAL_BAD_OFFSET ||
+	    metal_io_read32(io, 4) != 0x88)
+		return -EINVAL;
+	metal_regcache_finish(&cache);
+
+	metal_io_finish(&view);
+	metal_io_finish(&dev);
+	return 0;
+}
+METAL_ADD_TEST(regcache_subregion);